@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace rain_net {
+    namespace internal {
+        // Thread safe pool of buffers, grouped in size classes of powers of two
+        // Freed buffers are recycled instead of being returned to the global allocator
+        // Each thread keeps a cache of free buffers and only rarely exchanges them in batches with the shared lists,
+        // so that the network thread and the main thread don't contend
+        // Buffers bigger than the largest class are served directly by the global allocator
+        class BufferPool final {
+        public:
+            static constexpr std::size_t MIN_BUFFER_SIZE {64};
+            static constexpr std::size_t MAX_BUFFER_SIZE {65536};
+
+            BufferPool() = delete;
+
+            // Get the real size of a buffer that would be allocated for the requested size
+            static std::size_t buffer_size(std::size_t size) noexcept;
+
+            // The size must be the same in both calls
+            static void* allocate(std::size_t size);
+            static void deallocate(void* buffer, std::size_t size) noexcept;
+        };
+
+        // Standard allocator using the buffer pool, for containers and shared pointers
+        template<typename T>
+        struct PoolAllocator {
+            using value_type = T;
+
+            PoolAllocator() noexcept = default;
+
+            template<typename U>
+            PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+            T* allocate(std::size_t count) {
+                static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+                return static_cast<T*>(BufferPool::allocate(count * sizeof(T)));
+            }
+
+            void deallocate(T* pointer, std::size_t count) noexcept {
+                BufferPool::deallocate(pointer, count * sizeof(T));
+            }
+
+            template<typename U>
+            bool operator==(const PoolAllocator<U>&) const noexcept {
+                return true;
+            }
+
+            template<typename U>
+            bool operator!=(const PoolAllocator<U>&) const noexcept {
+                return false;
+            }
+        };
+    }
+}
@@ -2,6 +2,15 @@
 
 #include <utility>
 #include <cstddef>
+#include <array>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic push
@@ -10,20 +19,85 @@
 
 #include <asio/io_context.hpp>
 #include <asio/ip/tcp.hpp>
+#include <asio/buffer.hpp>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic pop
 #endif
 
 #include "rain_net/internal/message.hpp"
-#include "rain_net/internal/queue.hpp"
+#include "rain_net/internal/spsc_queue.hpp"
+#include "rain_net/internal/notifier.hpp"
+#include "rain_net/internal/receive_buffer.hpp"
+#include "rain_net/internal/buffer_pool.hpp"
+#include "rain_net/internal/options.hpp"
 
 namespace rain_net {
     namespace internal {
+        struct CoalescingKey final {
+            std::uint16_t id {};
+            std::uint64_t key {};
+
+            bool operator==(const CoalescingKey& other) const noexcept {
+                return id == other.id && key == other.key;
+            }
+        };
+
+        struct CoalescingKeyHash final {
+            std::size_t operator()(const CoalescingKey& key) const noexcept {
+                return std::hash<std::uint64_t>()(key.key * 0x9E3779B97F4A7C15u ^ key.id);
+            }
+        };
+
+        struct OutgoingMessage final {
+            SharedMessage message;
+            WireHeader header;
+            std::optional<CoalescingKey> coalescing_key;
+            std::chrono::steady_clock::time_point deadline {std::chrono::steady_clock::time_point::max()};
+        };
+
+        // Where a queued message with a coalescing key is
+        struct CoalescingEntry final {
+            OutgoingMessage* message {nullptr};
+            Priority priority {};
+        };
+
+        // Fixed capacity sequence of buffers for a single gathering write
+        class WriteBuffers final {
+        public:
+            void push_back(asio::const_buffer buffer) noexcept;
+
+            // Drop the bytes that have been written from the front
+            void consume(std::size_t size) noexcept;
+
+            void clear() noexcept;
+
+            // Get the amount of buffers left
+            std::size_t count() const noexcept;
+
+            const asio::const_buffer* begin() const noexcept;
+            const asio::const_buffer* end() const noexcept;
+        private:
+            std::array<asio::const_buffer, MAX_WRITE_BUFFERS> m_buffers;
+            std::size_t m_begin {};
+            std::size_t m_end {};
+        };
+
+        using OutgoingQueue = std::deque<OutgoingMessage, PoolAllocator<OutgoingMessage>>;
+
         class Connection {
         protected:
-            Connection(asio::io_context& asio_context, asio::ip::tcp::socket&& tcp_socket)
-                : m_asio_context(asio_context), m_tcp_socket(std::move(tcp_socket)) {}
+            Connection(
+                asio::io_context& asio_context,
+                asio::ip::tcp::socket&& tcp_socket,
+                const ConnectionOptions& options,
+                ReceiveSlab* receive_slab
+            )
+                : m_asio_context(asio_context), m_tcp_socket(std::move(tcp_socket)), m_options(options),
+                m_open(m_tcp_socket.is_open()), m_receive_buffer(receive_slab) {
+                // Never reallocate, because the buffers point into the messages
+                m_writing_messages.reserve(MAX_WRITE_BUFFERS);
+            }
 
             ~Connection() = default;
 
@@ -32,25 +106,139 @@ namespace rain_net {
             Connection(Connection&&) = delete;
             Connection& operator=(Connection&&) = delete;
 
+            enum class Received {
+                Message,  // A message is ready in m_current_incoming_message
+                NeedData,  // More data must be received
+                LargePayload,  // The rest of the payload must be read straight into m_current_incoming_message
+                TooLarge,  // The message is bigger than allowed
+                Hello  // The peer has advertised its capabilities; there is nothing to hand over
+            };
+
+            // How the peer frames its messages, and thus how it expects ours
+            enum class Framing {
+                Unknown,  // Its hello has not arrived yet
+                Classic,  // Only the 16 bit payload size
+                Extended
+            };
+
+            // Close the connection asynchronously; may be called from any thread
             void close();
-            bool is_open() const;
+
+            // May be called from any thread
+            bool is_open() const noexcept;
+
+            // Close the socket right away; call it in the network thread, or before the connection is used
+            void close_socket();
+
+            // Take the next message out of the receive buffer
+            // The first message decides the framing of the peer
+            Received receive_message();
+
+            // Put a message into its priority lane, or replace the queued message with the same coalescing key
+            // A replacement with a different priority moves to the back of its new lane
+            // Keyed messages that don't replace anything are checked against the limits here
+            // Applies the drop oldest policy
+            void queue_outgoing(SharedMessage&& message, const SendOptions& options);
+
+            // Check if there are queued messages in any priority lane
+            bool has_outgoing_messages() const noexcept;
+
+            // Move queued messages into the batch to be written, up to the limits from the options
+            // Higher priorities go first, except for lanes that have been skipped too many times
+            // The very first batch starts with the hello
+            // Returns false, if a message is too large for the peer; then the connection must be closed
+            bool gather_messages();
+
+            // Release the batch that has been written
+            void finish_writing();
+
+            // Check the limits of the outgoing queue before sending a message of this size
+            // Keyed messages always pass, as they may replace a queued message; queue_outgoing() checks them
+            // Returns true, if the message may be queued; otherwise the slow consumer policy has been applied
+            bool admit_outgoing(std::size_t size, const SendOptions& options);
+
+            // With the drop oldest policy, drop queued messages until the queue is within the limits again
+            // The message just queued in that priority lane is kept
+            void drop_oldest_outgoing(Priority priority);
+
+            // Account for a message of this size, unless the limits and the slow consumer policy say otherwise
+            bool check_queue_limits(std::size_t size);
+
+            // Account for a message of this size, if it fits within the limits
+            // May be called from any thread; concurrent calls never take the queue past the limits together
+            bool reserve_queue_space(std::size_t size) noexcept;
+
+            SlowConsumerStatistics get_slow_consumer_statistics() const noexcept;
+
+            // Move the front message of the lane into the batch, if it fits
+            bool gather_message(OutgoingQueue& queue, std::size_t max_buffers, std::size_t& size);
+
+            // Put our capabilities into the batch; it's not part of the outgoing queue
+            void gather_hello(std::size_t& size);
+
+            // Add the buffers of a message to the batch
+            void write_outgoing(OutgoingMessage& outgoing, std::size_t& size);
+
+            // Check if the message can be framed for the peer; messages that can't yet are held back
+            enum class Writable { Yes, NotYet, Never };
+            Writable writable(const Message& message) const noexcept;
+
+            // Take the capabilities of the peer out of its hello
+            Received receive_hello();
+
+            // Check if messages have been held back, which can be written now that the framing of the peer is known
+            // Returns true, if writing must be restarted
+            bool resume_held_back() noexcept;
+
+            // Remove the front message of the lane, which must be done through this
+            void pop_outgoing(OutgoingQueue& queue);
+
+            // Remove a keyed message from the middle of its lane
+            void erase_outgoing(const CoalescingEntry& entry);
+
+            // Drop the messages from the front of the lane that are past their deadline
+            void drop_expired_outgoing(OutgoingQueue& queue, std::chrono::steady_clock::time_point now);
 
             asio::io_context& m_asio_context;
             asio::ip::tcp::socket m_tcp_socket;
 
-            internal::SyncQueue<internal::BasicMessage> m_outgoing_messages;
-            internal::BasicMessage m_current_incoming_message;
-        };
+            ConnectionOptions m_options;
 
-        template<typename T>
-        std::size_t buffers_size(const T& buffers) noexcept {
-            std::size_t size {0};
+            // The socket itself must only be used in the network thread
+            std::atomic_bool m_open {false};
 
-            for (const auto& buffer : buffers) {
-                size += buffer.size();
-            }
+            // These are only accessed from the network thread
+            std::array<OutgoingQueue, PRIORITIES> m_outgoing_messages;  // One lane for each priority
+            std::array<std::size_t, PRIORITIES> m_skipped_writes {};  // How many writes in a row each lane has been skipped
+
+            // Queued messages that may be replaced; deques don't move their elements when pushing back or popping front
+            std::unordered_map<
+                CoalescingKey,
+                CoalescingEntry,
+                CoalescingKeyHash,
+                std::equal_to<CoalescingKey>,
+                PoolAllocator<std::pair<const CoalescingKey, CoalescingEntry>>
+            > m_coalescing_messages;
+            std::vector<OutgoingMessage> m_writing_messages;  // Messages currently being written
+            WriteBuffers m_write_buffers;
+            bool m_hello_sent {false};
+            bool m_writing_hello {false};  // The first of m_writing_messages is the hello
+            bool m_holding_back {false};  // Messages wait for the framing of the peer
+            Framing m_peer_framing {Framing::Unknown};
+
+            // Size of the outgoing queue, including the messages being written
+            std::atomic_size_t m_queued_bytes {};
+            std::atomic_size_t m_queued_messages {};
 
-            return size;
-        }
+            std::atomic_uint64_t m_dropped_oldest {};
+            std::atomic_uint64_t m_dropped_newest {};
+            std::atomic_uint64_t m_disconnects {};
+            std::atomic_uint64_t m_backpressure {};
+            std::atomic_uint64_t m_expired {};
+
+            internal::ReceiveBuffer m_receive_buffer;
+            internal::BasicMessage m_current_incoming_message;
+            std::size_t m_payload_received {};  // For large payloads, how much has been taken from the receive buffer
+        };
     }
 }
@@ -5,47 +5,107 @@
 #include <type_traits>
 #include <memory>
 #include <limits>
+#include <cstring>
+#include <string_view>
+
+#include "rain_net/internal/payload.hpp"
 
 namespace rain_net {
     class MessageReader;
+    class ForwardMessageReader;
     class Message;
 
     namespace internal {
         inline constexpr std::size_t MAX_ITEM_SIZE {std::numeric_limits<std::uint16_t>::max()};
 
+        // Type of the length prefix of strings and arrays
+        using ArraySize = std::uint32_t;
+
+        // Payloads bigger than this can't be written and are not accepted from the network
+        inline constexpr std::size_t MAX_PAYLOAD_SIZE {64 * 1024 * 1024};
+
+        // On the network, the header is the 16 bit ID followed by the 16 bit payload size
+        // With the extended header, payloads of 65535 bytes and more mark their size with EXTENDED_PAYLOAD_SIZE
+        // and are followed by the real 32 bit size; smaller payloads are framed the same either way
+        // The extended header is only used with peers that have advertised it; see HELLO_ID
+        inline constexpr std::size_t HEADER_SIZE {4};
+        inline constexpr std::size_t EXTENDED_HEADER_SIZE {8};
+        inline constexpr std::uint16_t EXTENDED_PAYLOAD_SIZE {std::numeric_limits<std::uint16_t>::max()};
+
+        // Every connection first sends a message with this ID and its capabilities as payload; the ID is reserved
+        // A peer whose first message is not a hello is from before the handshake, and only gets the classic header
+        // Such peers receive the hello as a regular message, which they should ignore
+        // Until the hello of the peer has arrived, payloads of 65535 bytes and more are held back
+        inline constexpr std::uint16_t HELLO_ID {std::numeric_limits<std::uint16_t>::max()};
+
+        using Capabilities = std::uint32_t;
+
+        inline constexpr Capabilities EXTENDED_HEADER_CAPABILITY {1u << 0};
+
         struct MsgHeader final {
             std::uint16_t id {};
-            std::uint16_t payload_size {};
+            std::uint32_t payload_size {};
         };
 
         static_assert(std::is_trivially_copyable_v<MsgHeader>);
 
+        // Header encoded for sending
+        struct WireHeader final {
+            unsigned char bytes[EXTENDED_HEADER_SIZE] {};
+            std::size_t size {};
+        };
+
+        // Get the size of the header on the network
+        std::size_t header_size(std::uint32_t payload_size) noexcept;
+
+        // Without the extended header, the payload must not be bigger than 65535 bytes
+        WireHeader encode_header(const MsgHeader& header, bool extended) noexcept;
+
+        // Decode the first HEADER_SIZE bytes; returns true, if the extended size follows, given the extended header
+        bool decode_header(const unsigned char* bytes, MsgHeader& header) noexcept;
+
+        // Decode the 32 bit size that follows an extended header
+        void decode_extended_size(const unsigned char* bytes, MsgHeader& header) noexcept;
+
         struct BasicMessage final {
             MsgHeader header;
-            std::unique_ptr<unsigned char[]> payload;
+            Payload payload;
         };
 
-        BasicMessage clone_message(const Message& message);
+        // Get the parts of a message that are written to the socket
+        const MsgHeader& message_header(const Message& message) noexcept;
+        const unsigned char* message_payload(const Message& message) noexcept;
     }
 
     // Class representing a message, a blob of data
     // Messages can only contain data from trivially copyable types
+    // The ID 65535 is reserved for the handshake of the connections
     class Message final {
     public:
         Message() noexcept = default;
         explicit Message(std::uint16_t id) noexcept;
-        Message(internal::MsgHeader header, std::unique_ptr<unsigned char[]>&& payload) noexcept;
+        explicit Message(internal::BasicMessage&& message) noexcept;
 
         ~Message() noexcept = default;
 
         Message(const Message& other);
         Message& operator=(const Message& other);
-        Message(Message&&) noexcept = default;
-        Message& operator=(Message&&) noexcept = default;
+        Message(Message&& other) noexcept;
+        Message& operator=(Message&& other) noexcept;
 
         // Get the size of the message, including header and payload
         std::size_t size() const noexcept;
 
+        // Get the amount of payload bytes that can be held without reallocating
+        std::size_t capacity() const noexcept;
+
+        // Preallocate space for at least the specified amount of payload bytes
+        // Use this before writing many fields to avoid reallocations
+        void reserve(std::size_t capacity);
+
+        // Release the unused payload space
+        void shrink_to_fit();
+
         // Get the message ID
         std::uint16_t id() const noexcept;
 
@@ -59,15 +119,60 @@ namespace rain_net {
         }
 
         // Write raw data to the message
+        // Throws std::length_error, if the payload would get bigger than internal::MAX_PAYLOAD_SIZE
         Message& write(const void* data, std::size_t size);
+
+        // Write a length-prefixed string to the message; read it with ForwardMessageReader
+        // Throws std::length_error, if the payload would get too big; then nothing is written
+        Message& write_string(std::string_view string);
+
+        // Write a length-prefixed array to the message; read it with ForwardMessageReader
+        // Throws std::length_error, if the payload would get too big; then nothing is written
+        template<typename T>
+        Message& write_array(const T* data, std::size_t count) {
+            static_assert(std::is_trivially_copyable_v<T>);
+
+            check_payload_size(sizeof(internal::ArraySize), count, sizeof(T));
+
+            *this << static_cast<internal::ArraySize>(count);
+
+            return write(data, sizeof(T) * count);
+        }
     private:
-        void resize(std::size_t additional_size);
+        void grow(std::size_t required_capacity);
+
+        // Throw, if prefix_size + count * item_size more bytes don't fit in the payload
+        void check_payload_size(std::size_t prefix_size, std::size_t count, std::size_t item_size = 1) const;
 
         internal::MsgHeader m_header;
-        std::unique_ptr<unsigned char[]> m_payload;
+        internal::Payload m_payload;
 
         friend class MessageReader;
-        friend internal::BasicMessage internal::clone_message(const Message& message);
+        friend class ForwardMessageReader;
+        friend const internal::MsgHeader& internal::message_header(const Message& message) noexcept;
+        friend const unsigned char* internal::message_payload(const Message& message) noexcept;
+    };
+
+    // Class representing an immutable, reference counted message
+    // Copying it doesn't copy the payload, thus it's cheap to send it to many clients
+    class SharedMessage final {
+    public:
+        // Copy the message once
+        explicit SharedMessage(const Message& message);
+
+        // Take the message without copying it
+        explicit SharedMessage(Message&& message);
+
+        // Get the size of the message, including header and payload
+        std::size_t size() const noexcept;
+
+        // Get the message ID
+        std::uint16_t id() const noexcept;
+
+        // Get the underlying message, for example to read it
+        const Message& get() const noexcept;
+    private:
+        std::shared_ptr<const Message> m_message;
     };
 
     // Class used for reading messages
@@ -91,4 +196,91 @@ namespace rain_net {
         std::size_t m_pointer {};
         const Message* m_message {nullptr};
     };
+
+    // View of an array of trivially copyable values inside a message, without copying the whole array
+    // The values are not necessarily aligned, so they are copied out one at a time
+    template<typename T>
+    class ArrayView final {
+    public:
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        ArrayView() noexcept = default;
+        ArrayView(const unsigned char* data, std::size_t count) noexcept
+            : m_data(data), m_count(count) {}
+
+        T operator[](std::size_t index) const noexcept {
+            T value;
+            std::memcpy(&value, m_data + index * sizeof(T), sizeof(T));
+
+            return value;
+        }
+
+        // Get the raw bytes of the array
+        const unsigned char* data() const noexcept { return m_data; }
+
+        std::size_t size() const noexcept { return m_count; }
+        bool empty() const noexcept { return m_count == 0; }
+    private:
+        const unsigned char* m_data {nullptr};
+        std::size_t m_count {};
+    };
+
+    // Class used for reading messages in the order in which they were written
+    // Besides copying out values, it can return views straight into the payload
+    // Views are valid as long as the message is alive and not modified
+    // Reading past the end of the message doesn't read anything and puts the reader in a failed state
+    class ForwardMessageReader final {
+    public:
+        // Read data from the message; must be done in the same order as writing
+        template<typename T>
+        ForwardMessageReader& operator>>(T& data) noexcept {
+            static_assert(std::is_trivially_copyable_v<T>);
+            static_assert(sizeof(T) <= internal::MAX_ITEM_SIZE);
+
+            return read(&data, sizeof(T));
+        }
+
+        // Read raw data from the message; must be done in the same order as writing
+        // On failure the data is zeroed
+        ForwardMessageReader& read(void* data, std::size_t size) noexcept;
+
+        // Get a view of the next raw bytes; returns null on failure
+        const unsigned char* view(std::size_t size) noexcept;
+
+        // Get a view of the next bytes as a string
+        std::string_view view_string(std::size_t size) noexcept;
+
+        // Get a view of a string written with Message::write_string()
+        std::string_view read_string() noexcept;
+
+        // Get a view of an array written with Message::write_array()
+        template<typename T>
+        ArrayView<T> read_array() noexcept {
+            static_assert(std::is_trivially_copyable_v<T>);
+
+            internal::ArraySize count {};
+            *this >> count;
+
+            const unsigned char* data {view(sizeof(T) * count)};
+
+            if (data == nullptr) {
+                return {};
+            }
+
+            return ArrayView<T>(data, count);
+        }
+
+        // Get the amount of bytes left to read
+        std::size_t remaining() const noexcept;
+
+        // Check if all the reads so far were within the bounds of the message
+        bool good() const noexcept;
+
+        // Start reading the contents of a message
+        ForwardMessageReader& operator()(const Message& message) noexcept;
+    private:
+        std::size_t m_pointer {};
+        const Message* m_message {nullptr};
+        bool m_failed {false};
+    };
 }
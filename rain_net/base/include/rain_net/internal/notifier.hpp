@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+namespace rain_net {
+    namespace internal {
+        // Lets consumer threads sleep until producer threads make work available, instead of polling
+        // Notifying is cheap when nobody waits: a fence and an atomic load
+        // Optionally, it also signals an event handle that can be polled by other event loops
+        class Notifier final {
+        public:
+            Notifier() = default;
+            ~Notifier();
+
+            Notifier(const Notifier&) = delete;
+            Notifier& operator=(const Notifier&) = delete;
+            Notifier(Notifier&&) = delete;
+            Notifier& operator=(Notifier&&) = delete;
+
+            // Call this after making work available
+            void notify() {
+                // Pairs with the fence in wait(): either the waiter sees the work, or this sees the waiter
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (m_waiters.load(std::memory_order_relaxed) > 0) {
+                    std::lock_guard<std::mutex> lock {m_mutex};
+                    m_condition.notify_all();
+                }
+
+                // Only the first notification after a reset writes to the handle
+                if (m_event_handle.load(std::memory_order_acquire) != INVALID_HANDLE) {
+                    if (!m_event_signaled.load(std::memory_order_relaxed)) {
+                        signal_event();
+                    }
+                }
+            }
+
+            // Get the event handle, creating it the first time; it becomes readable after notify()
+            // Returns INVALID_HANDLE, if event handles are not supported on this platform
+            int event_handle();
+
+            // Make the event handle not readable anymore, if the consumer has no more work
+            // Call this on the consumer thread, after it has processed the available work
+            template<typename Predicate>
+            void reset_event(Predicate has_work) {
+                if (!m_event_signaled.load(std::memory_order_relaxed)) {
+                    return;
+                }
+
+                clear_event();
+
+                // Pairs with the fence in notify(): either this sees the work, or notify() sees the reset
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (has_work()) {
+                    signal_event();
+                }
+            }
+
+            static constexpr int INVALID_HANDLE {-1};
+
+            // Wait until the predicate is true or until the timeout expires
+            // Spin for a while before sleeping, as it reacts faster
+            // A timeout too big for the clock, like nanoseconds::max(), waits forever
+            // Returns the last result of the predicate
+            template<typename Predicate>
+            bool wait(std::chrono::nanoseconds timeout, std::chrono::nanoseconds spin, Predicate predicate) {
+                using Clock = std::chrono::steady_clock;
+
+                const auto now {Clock::now()};
+
+                // Saturate instead of overflowing
+                const auto after {[now](std::chrono::nanoseconds duration) {
+                    if (duration <= std::chrono::nanoseconds::zero()) {
+                        return now;
+                    }
+
+                    if (duration >= Clock::time_point::max() - now) {
+                        return Clock::time_point::max();
+                    }
+
+                    return now + std::chrono::duration_cast<Clock::duration>(duration);
+                }};
+
+                const auto deadline {after(timeout)};
+                const auto spin_deadline {after(std::min(spin, timeout))};
+
+                while (!predicate()) {
+                    if (Clock::now() >= spin_deadline) {
+                        break;
+                    }
+                }
+
+                std::unique_lock<std::mutex> lock {m_mutex};
+
+                m_waiters.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                bool result {true};
+
+                if (deadline == Clock::time_point::max()) {
+                    m_condition.wait(lock, predicate);
+                } else {
+                    result = m_condition.wait_until(lock, deadline, predicate);
+                }
+
+                m_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+                return result;
+            }
+        private:
+            void signal_event();
+            void clear_event();
+
+            std::mutex m_mutex;
+            std::condition_variable m_condition;
+            std::atomic<unsigned int> m_waiters {0};
+            std::atomic_int m_event_handle {INVALID_HANDLE};
+            std::atomic_bool m_event_signaled {false};
+        };
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <chrono>
+
+namespace rain_net {
+    namespace internal {
+        // Upper bound of buffers gathered into a single write; a message takes one or two buffers
+        inline constexpr std::size_t MAX_WRITE_BUFFERS {64};
+
+        // Amount of priority lanes in the outgoing queue
+        inline constexpr std::size_t PRIORITIES {4};
+
+        // Whether the event loops run on io_uring instead of epoll (see RAIN_NET_IO_URING)
+#ifdef ASIO_HAS_IO_URING
+        inline constexpr bool IO_URING {true};
+#else
+        inline constexpr bool IO_URING {false};
+#endif
+    }
+
+    // Priority of an outgoing message; messages with higher priority are written first
+    enum class Priority {
+        Critical,
+        High,
+        Normal,
+        Bulk
+    };
+
+    // Options for sending a single message
+    struct SendOptions {
+        Priority priority {Priority::Normal};
+
+        // Latest value wins: a queued message with the same ID and key, that is not yet being written,
+        // is replaced in place by this one; use it for updates of which only the newest value matters
+        // If the priority is different, the old message is removed and this one goes to the back of its lane
+        // Replacing is not limited by the slow consumer policy; a keyed message that replaces nothing
+        // is checked in the network thread, so sending it returns true even if the policy then drops it
+        std::optional<std::uint64_t> coalescing_key;
+
+        // A message that is still queued after this point in time is dropped instead of written
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+    };
+
+    // What to do when the outgoing queue of a connection is full, because the peer doesn't keep up
+    enum class SlowConsumerPolicy {
+        DropOldest,  // Drop the oldest queued messages to make room
+        DropNewest,  // Drop the message being sent
+        Disconnect,  // Close the connection
+        Backpressure  // Don't send the message and report it to the caller
+    };
+
+    // Options for tuning the connections
+    struct ConnectionOptions {
+        // Queued messages are gathered into a single write, up to this many bytes
+        // A message bigger than this is still written, but alone
+        std::size_t max_write_size {256 * 1024};
+
+        // Queued messages are gathered into a single write, up to this many buffers
+        // It's capped at internal::MAX_WRITE_BUFFERS
+        std::size_t max_write_buffers {internal::MAX_WRITE_BUFFERS};
+
+        // Limits of the outgoing queue, including the messages currently being written
+        // A message is always accepted, when the queue is empty
+        // They hold even when several threads send to the same connection at once
+        // Exceptions: the drop oldest policy accepts first and trims the queue afterwards,
+        // and a keyed message replacing a queued one may be bigger than the old one
+        std::size_t max_queued_bytes {64 * 1024 * 1024};
+        std::size_t max_queued_messages {std::numeric_limits<std::size_t>::max()};
+
+        // What to do when the limits are reached
+        // Drop oldest drops from the lowest priorities first
+        SlowConsumerPolicy slow_consumer_policy {SlowConsumerPolicy::Backpressure};
+
+        // A priority lane that has been passed over for this many writes in a row
+        // gets its next message written first, so that lower priorities are not starved
+        std::size_t max_skipped_writes {8};
+    };
+
+    // How many times the slow consumer policy has been applied on a connection
+    struct SlowConsumerStatistics {
+        std::uint64_t dropped_oldest {};  // Messages dropped from the queue
+        std::uint64_t dropped_newest {};  // Messages dropped when sending
+        std::uint64_t disconnects {};  // One, if the connection has been closed because of the limits
+        std::uint64_t backpressure {};  // Messages refused and reported to the caller
+        std::uint64_t expired {};  // Messages dropped, because their deadline passed while queued
+    };
+}
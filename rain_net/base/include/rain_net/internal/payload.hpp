@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+
+namespace rain_net {
+    namespace internal {
+        // Payloads up to this size don't allocate
+        inline constexpr std::size_t INLINE_PAYLOAD_SIZE {32};
+
+        // Storage for message payloads
+        // Small payloads are stored inline and spill to the heap only when they grow past the threshold
+        // Heap buffers come from the buffer pool
+        // It doesn't keep track of its size; that is the job of the owner
+        class Payload final {
+        public:
+            Payload() noexcept = default;
+            ~Payload() noexcept;
+
+            Payload(const Payload&) = delete;
+            Payload& operator=(const Payload&) = delete;
+            Payload(Payload&& other) noexcept;
+            Payload& operator=(Payload&& other) noexcept;
+
+            unsigned char* data() noexcept;
+            const unsigned char* data() const noexcept;
+            std::size_t capacity() const noexcept;
+
+            // Make room for at least capacity bytes, preserving the first size bytes
+            void reserve(std::size_t capacity, std::size_t size);
+
+            // Release the space beyond the first size bytes, moving back inline if possible
+            void shrink_to_fit(std::size_t size);
+        private:
+            void reallocate(std::size_t capacity, std::size_t size);
+
+            unsigned char* m_heap {nullptr};
+            std::size_t m_capacity {INLINE_PAYLOAD_SIZE};
+            unsigned char m_inline[INLINE_PAYLOAD_SIZE] {};
+        };
+    }
+}
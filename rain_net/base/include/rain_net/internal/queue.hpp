@@ -5,6 +5,8 @@
 #include <utility>
 #include <cstddef>
 
+#include "rain_net/internal/buffer_pool.hpp"
+
 namespace rain_net {
     namespace internal {
         template<typename T>
@@ -77,7 +79,7 @@ namespace rain_net {
                 return m_queue.clear();
             }
         private:
-            std::deque<T> m_queue;
+            std::deque<T, PoolAllocator<T>> m_queue;
             mutable std::mutex m_mutex;
         };
     }
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <array>
+#include <memory>
+#include <optional>
+
+#ifdef __GNUG__
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wconversion"
+#endif
+
+#include <asio/buffer.hpp>
+#include <asio/registered_buffer.hpp>
+
+#ifdef __GNUG__
+    #pragma GCC diagnostic pop
+#endif
+
+#include "rain_net/internal/receive_slab.hpp"
+
+namespace rain_net {
+    namespace internal {
+        // Ring buffer into which data from the socket is received in bulk, so that many messages are read at once
+        class ReceiveBuffer final {
+        public:
+            // Must be a power of two
+            static constexpr std::size_t CAPACITY {8192};
+
+            // Take the memory from the slab, if there is one with buffers left
+            explicit ReceiveBuffer(ReceiveSlab* slab = nullptr);
+            ~ReceiveBuffer();
+
+            ReceiveBuffer(const ReceiveBuffer&) = delete;
+            ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+            ReceiveBuffer(ReceiveBuffer&&) = delete;
+            ReceiveBuffer& operator=(ReceiveBuffer&&) = delete;
+
+            // Get the free space into which to receive; it wraps around, so it's made of two buffers
+            std::array<asio::mutable_buffer, 2> free_space() noexcept;
+
+            // Get the free space as a single registered buffer, if the memory is registered and the space doesn't wrap around
+            std::optional<asio::mutable_registered_buffer> registered_free_space() const noexcept;
+
+            // Mark bytes as received into the free space
+            void produce(std::size_t size) noexcept;
+
+            // Get the amount of bytes received and not yet consumed
+            std::size_t size() const noexcept;
+
+            // Copy bytes out without consuming them
+            void peek(void* data, std::size_t size) const noexcept;
+
+            // Copy bytes out and consume them
+            void read(void* data, std::size_t size) noexcept;
+
+            void consume(std::size_t size) noexcept;
+        private:
+            static constexpr std::size_t MASK {CAPACITY - 1};
+
+            static_assert((CAPACITY & MASK) == 0);
+
+            unsigned char* m_buffer {nullptr};
+            std::unique_ptr<unsigned char[]> m_own_buffer;  // Used when there is no registered memory
+
+            ReceiveSlab* m_slab {nullptr};
+            asio::mutable_registered_buffer m_registered_buffer;
+
+            // These only grow and are wrapped when indexing
+            std::size_t m_read_position {};
+            std::size_t m_write_position {};
+        };
+    }
+}
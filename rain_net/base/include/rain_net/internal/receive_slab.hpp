@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <optional>
+
+#ifdef __GNUG__
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wconversion"
+#endif
+
+#include <asio/io_context.hpp>
+#include <asio/buffer.hpp>
+#include <asio/buffer_registration.hpp>
+#include <asio/registered_buffer.hpp>
+
+#ifdef __GNUG__
+    #pragma GCC diagnostic pop
+#endif
+
+namespace rain_net {
+    namespace internal {
+        // Memory for the receive buffers of the connections of an event loop, registered with it once
+        // With io_uring, reads into registered memory are fixed reads, which don't map the pages every time
+        // Otherwise, the registration does nothing
+        class ReceiveSlab final {
+        public:
+            // Register memory for this many receive buffers of this size
+            // Throws std::system_error, if the memory couldn't be registered, e.g. because of RLIMIT_MEMLOCK
+            ReceiveSlab(asio::io_context& asio_context, std::size_t buffers, std::size_t buffer_size);
+            ~ReceiveSlab() = default;
+
+            ReceiveSlab(const ReceiveSlab&) = delete;
+            ReceiveSlab& operator=(const ReceiveSlab&) = delete;
+            ReceiveSlab(ReceiveSlab&&) = delete;
+            ReceiveSlab& operator=(ReceiveSlab&&) = delete;
+
+            // Take a receive buffer; returns nothing, if all are taken
+            // May be called from any thread
+            std::optional<asio::mutable_registered_buffer> allocate();
+
+            // Give a buffer back; may be called from any thread
+            void deallocate(const asio::mutable_registered_buffer& buffer);
+        private:
+            std::size_t m_buffer_size {};
+            std::unique_ptr<unsigned char[]> m_memory;
+            asio::buffer_registration<asio::mutable_buffer> m_registration;
+
+            std::mutex m_mutex;
+            std::vector<std::size_t> m_free;  // Indices of the buffers not taken
+        };
+    }
+}
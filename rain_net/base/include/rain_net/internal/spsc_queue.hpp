@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <cstddef>
+#include <cassert>
+
+#include "rain_net/internal/buffer_pool.hpp"
+
+namespace rain_net {
+    namespace internal {
+        // Assumed size of a cache line
+        inline constexpr std::size_t CACHE_LINE_SIZE {64};
+
+        // Unbounded lock-free queue for exactly one producer thread and one consumer thread
+        // The producer may only push; the consumer may only pop, query and clear
+        // Consumed nodes are recycled by the producer, so in steady state it doesn't allocate
+        template<typename T>
+        class SpscQueue {
+        public:
+            SpscQueue() {
+                Node* node {allocate_node()};
+
+                m_tail.store(node, std::memory_order_relaxed);
+                m_head = node;
+                m_first = node;
+                m_tail_copy = node;
+            }
+
+            ~SpscQueue() {
+                Node* node {m_first};
+
+                while (node != nullptr) {
+                    Node* next {node->next.load(std::memory_order_relaxed)};
+                    deallocate_node(node);
+                    node = next;
+                }
+            }
+
+            SpscQueue(const SpscQueue&) = delete;
+            SpscQueue& operator=(const SpscQueue&) = delete;
+            SpscQueue(SpscQueue&&) = delete;
+            SpscQueue& operator=(SpscQueue&&) = delete;
+
+            void push_back(const T& item) {
+                Node* node {allocate_node()};
+                node->item.emplace(item);
+
+                publish(node);
+            }
+
+            void push_back(T&& item) {
+                Node* node {allocate_node()};
+                node->item.emplace(std::move(item));
+
+                publish(node);
+            }
+
+            // The queue must not be empty
+            T pop_front() {
+                Node* tail {m_tail.load(std::memory_order_relaxed)};
+                Node* next {tail->next.load(std::memory_order_acquire)};
+
+                assert(next != nullptr);
+
+                T item {std::move(*next->item)};
+                next->item.reset();
+
+                // The next node becomes the empty front node and the old one is given back to the producer
+                m_tail.store(next, std::memory_order_release);
+
+                return item;
+            }
+
+            // Pop up to max items at once, appending them to the container
+            // Returns the amount of items popped
+            // If appending throws, the items appended so far are popped and the rest stay in the queue
+            template<typename Container>
+            std::size_t pop_front(Container& container, std::size_t max) {
+                Node* tail {m_tail.load(std::memory_order_relaxed)};
+                std::size_t count {0};
+
+                try {
+                    while (count < max) {
+                        Node* next {tail->next.load(std::memory_order_acquire)};
+
+                        if (next == nullptr) {
+                            break;
+                        }
+
+                        // Only consume the node once the item is in the container
+                        container.push_back(std::move(*next->item));
+                        next->item.reset();
+
+                        tail = next;
+                        count++;
+                    }
+                } catch (...) {
+                    // The queue must not keep emptied nodes in front of it
+                    m_tail.store(tail, std::memory_order_release);
+                    throw;
+                }
+
+                // Give all the consumed nodes back to the producer at once
+                m_tail.store(tail, std::memory_order_release);
+
+                return count;
+            }
+
+            bool empty() const {
+                return m_tail.load(std::memory_order_relaxed)->next.load(std::memory_order_acquire) == nullptr;
+            }
+
+            void clear() {
+                while (!empty()) {
+                    pop_front();
+                }
+            }
+        private:
+            struct Node {
+                std::atomic<Node*> next {nullptr};
+                std::optional<T> item;
+            };
+
+            void publish(Node* node) {
+                node->next.store(nullptr, std::memory_order_relaxed);
+                m_head->next.store(node, std::memory_order_release);
+                m_head = node;
+            }
+
+            Node* allocate_node() {
+                // First try to reuse a node already consumed
+                if (m_first != m_tail_copy) {
+                    return reuse_node();
+                }
+
+                m_tail_copy = m_tail.load(std::memory_order_acquire);
+
+                if (m_first != m_tail_copy) {
+                    return reuse_node();
+                }
+
+                Node* node {PoolAllocator<Node>().allocate(1)};
+                return new (node) Node;
+            }
+
+            Node* reuse_node() {
+                Node* node {m_first};
+                m_first = m_first->next.load(std::memory_order_relaxed);
+
+                return node;
+            }
+
+            static void deallocate_node(Node* node) {
+                node->~Node();
+                PoolAllocator<Node>().deallocate(node, 1);
+            }
+
+            // Consumer side; the last consumed node, which is empty
+            alignas(CACHE_LINE_SIZE) std::atomic<Node*> m_tail {nullptr};
+
+            // Producer side; the last pushed node and the range of consumed nodes to reuse
+            alignas(CACHE_LINE_SIZE) Node* m_head {nullptr};
+            Node* m_first {nullptr};
+            Node* m_tail_copy {nullptr};
+        };
+    }
+}
@@ -0,0 +1,197 @@
+#include "rain_net/internal/buffer_pool.hpp"
+
+#include <mutex>
+#include <algorithm>
+
+namespace rain_net {
+    namespace internal {
+        // 64, 128, ..., 65536
+        static constexpr std::size_t SIZE_CLASSES {11};
+
+        static_assert(BufferPool::MIN_BUFFER_SIZE << (SIZE_CLASSES - 1) == BufferPool::MAX_BUFFER_SIZE);
+
+        // How many bytes of free buffers of each class a thread may keep for itself
+        static constexpr std::size_t THREAD_CACHE_SIZE {256 * 1024};
+
+        // How many times the thread cache limit the shared list of each class may hold
+        // Beyond that, buffers go back to the global allocator, so that a burst doesn't pin memory forever
+        static constexpr std::size_t SHARED_CACHE_FACTOR {8};
+
+        struct FreeBuffer {
+            FreeBuffer* next;
+        };
+
+        struct FreeList {
+            void push(FreeBuffer* buffer) noexcept {
+                buffer->next = head;
+                head = buffer;
+                count++;
+            }
+
+            FreeBuffer* pop() noexcept {
+                FreeBuffer* buffer {head};
+                head = buffer->next;
+                count--;
+
+                return buffer;
+            }
+
+            FreeBuffer* head {nullptr};
+            std::size_t count {0};
+        };
+
+        struct SharedFreeList {
+            FreeList list;
+            std::mutex mutex;
+        };
+
+        struct ThreadCache {
+            ThreadCache() = default;
+            ~ThreadCache();
+
+            ThreadCache(const ThreadCache&) = delete;
+            ThreadCache& operator=(const ThreadCache&) = delete;
+            ThreadCache(ThreadCache&&) = delete;
+            ThreadCache& operator=(ThreadCache&&) = delete;
+
+            FreeList lists[SIZE_CLASSES];
+        };
+
+        static std::size_t size_class(std::size_t buffer_size) noexcept {
+            std::size_t index {0};
+
+            while ((BufferPool::MIN_BUFFER_SIZE << index) < buffer_size) {
+                index++;
+            }
+
+            return index;
+        }
+
+        static std::size_t cache_limit(std::size_t index) noexcept {
+            return std::max<std::size_t>(THREAD_CACHE_SIZE / (BufferPool::MIN_BUFFER_SIZE << index), 4);
+        }
+
+        static std::size_t shared_limit(std::size_t index) noexcept {
+            return cache_limit(index) * SHARED_CACHE_FACTOR;
+        }
+
+        static SharedFreeList* shared_lists() noexcept {
+            // Never destroyed, as buffers may be freed late during program exit
+            static SharedFreeList* lists {new SharedFreeList[SIZE_CLASSES]};
+
+            return lists;
+        }
+
+        // Thread caches are gone after thread exit; fall back to the shared lists
+        static thread_local bool g_thread_cache_destroyed {false};
+        static thread_local ThreadCache g_thread_cache;
+
+        // Move up to count buffers from one list to another
+        static void transfer(FreeList& from, FreeList& to, std::size_t count) noexcept {
+            while (from.head != nullptr && count > 0) {
+                to.push(from.pop());
+                count--;
+            }
+        }
+
+        // Move up to count buffers to the shared list of their class; the ones that don't fit are freed
+        static void give_back(FreeList& from, std::size_t index, std::size_t count) noexcept {
+            SharedFreeList& shared {shared_lists()[index]};
+
+            {
+                std::lock_guard<std::mutex> lock {shared.mutex};
+
+                const std::size_t limit {shared_limit(index)};
+                const std::size_t room {shared.list.count < limit ? limit - shared.list.count : 0};
+                const std::size_t moved {std::min(count, room)};
+
+                transfer(from, shared.list, moved);
+                count -= moved;
+            }
+
+            while (from.head != nullptr && count > 0) {
+                ::operator delete(from.pop());
+                count--;
+            }
+        }
+
+        ThreadCache::~ThreadCache() {
+            for (std::size_t i {0}; i < SIZE_CLASSES; i++) {
+                give_back(lists[i], i, lists[i].count);
+            }
+
+            g_thread_cache_destroyed = true;
+        }
+
+        std::size_t BufferPool::buffer_size(std::size_t size) noexcept {
+            if (size > MAX_BUFFER_SIZE) {
+                return size;
+            }
+
+            return MIN_BUFFER_SIZE << size_class(size);
+        }
+
+        void* BufferPool::allocate(std::size_t size) {
+            if (size > MAX_BUFFER_SIZE) {
+                return ::operator new(size);
+            }
+
+            const std::size_t index {size_class(size)};
+            SharedFreeList& shared {shared_lists()[index]};
+
+            if (g_thread_cache_destroyed) {
+                std::lock_guard<std::mutex> lock {shared.mutex};
+
+                if (shared.list.head != nullptr) {
+                    return shared.list.pop();
+                }
+            } else {
+                FreeList& cache {g_thread_cache.lists[index]};
+
+                if (cache.head == nullptr) {
+                    // Refill half of the cache at once
+                    std::lock_guard<std::mutex> lock {shared.mutex};
+                    transfer(shared.list, cache, cache_limit(index) / 2);
+                }
+
+                if (cache.head != nullptr) {
+                    return cache.pop();
+                }
+            }
+
+            return ::operator new(MIN_BUFFER_SIZE << index);
+        }
+
+        void BufferPool::deallocate(void* buffer, std::size_t size) noexcept {
+            if (buffer == nullptr) {
+                return;
+            }
+
+            if (size > MAX_BUFFER_SIZE) {
+                ::operator delete(buffer);
+                return;
+            }
+
+            const std::size_t index {size_class(size)};
+
+            // The buffer is at least as big as a pointer, so use it as a list node
+            auto free_buffer {static_cast<FreeBuffer*>(buffer)};
+
+            if (g_thread_cache_destroyed) {
+                FreeList list;
+                list.push(free_buffer);
+                give_back(list, index, 1);
+
+                return;
+            }
+
+            FreeList& cache {g_thread_cache.lists[index]};
+            cache.push(free_buffer);
+
+            if (cache.count > cache_limit(index)) {
+                // Give back half of the cache at once
+                give_back(cache, index, cache_limit(index) / 2);
+            }
+        }
+    }
+}
@@ -1,11 +1,16 @@
 #include "rain_net/internal/connection.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
 #ifdef __GNUG__
     #pragma GCC diagnostic push
     #pragma GCC diagnostic ignored "-Wconversion"
 #endif
 
 #include <asio/post.hpp>
+#include <asio/error_code.hpp>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic pop
@@ -13,18 +18,523 @@
 
 namespace rain_net {
     namespace internal {
+        void WriteBuffers::push_back(asio::const_buffer buffer) noexcept {
+            assert(m_end < MAX_WRITE_BUFFERS);
+
+            m_buffers[m_end++] = buffer;
+        }
+
+        void WriteBuffers::consume(std::size_t size) noexcept {
+            while (m_begin < m_end && size >= m_buffers[m_begin].size()) {
+                size -= m_buffers[m_begin].size();
+                m_begin++;
+            }
+
+            if (m_begin < m_end) {
+                m_buffers[m_begin] += size;
+            }
+        }
+
+        void WriteBuffers::clear() noexcept {
+            m_begin = 0;
+            m_end = 0;
+        }
+
+        std::size_t WriteBuffers::count() const noexcept {
+            return m_end - m_begin;
+        }
+
+        const asio::const_buffer* WriteBuffers::begin() const noexcept {
+            return m_buffers.data() + m_begin;
+        }
+
+        const asio::const_buffer* WriteBuffers::end() const noexcept {
+            return m_buffers.data() + m_end;
+        }
+
         void Connection::close() {
             asio::post(m_asio_context, [this]() {
                 if (!m_tcp_socket.is_open()) {
                     return;
                 }
 
-                m_tcp_socket.close();
+                close_socket();
             });
         }
 
-        bool Connection::is_open() const {
-            return m_tcp_socket.is_open();
+        bool Connection::is_open() const noexcept {
+            return m_open.load(std::memory_order_acquire);
+        }
+
+        void Connection::close_socket() {
+            m_open.store(false, std::memory_order_release);
+
+            asio::error_code ec;
+            m_tcp_socket.close(ec);
+        }
+
+        Connection::Received Connection::receive_message() {
+            if (m_receive_buffer.size() < HEADER_SIZE) {
+                return Received::NeedData;
+            }
+
+            MsgHeader& header {m_current_incoming_message.header};
+            unsigned char header_bytes[EXTENDED_HEADER_SIZE] {};
+            std::size_t header_size {HEADER_SIZE};
+
+            m_receive_buffer.peek(header_bytes, HEADER_SIZE);
+
+            // Check if the real payload size follows; only peers that have advertised it send it
+            if (decode_header(header_bytes, header) && m_peer_framing == Framing::Extended) {
+                if (m_receive_buffer.size() < EXTENDED_HEADER_SIZE) {
+                    return Received::NeedData;
+                }
+
+                m_receive_buffer.peek(header_bytes, EXTENDED_HEADER_SIZE);
+                decode_extended_size(header_bytes + HEADER_SIZE, header);
+
+                header_size = EXTENDED_HEADER_SIZE;
+            }
+
+            if (header.payload_size > MAX_PAYLOAD_SIZE) {
+                return Received::TooLarge;
+            }
+
+            const bool hello {
+                m_peer_framing == Framing::Unknown &&
+                header.id == HELLO_ID &&
+                header.payload_size == sizeof(Capabilities)
+            };
+
+            // Peers from before the handshake start right away with their own messages
+            if (m_peer_framing == Framing::Unknown && !hello) {
+                m_peer_framing = Framing::Classic;
+            }
+
+            // Payloads that can never fit in the buffer are read separately, straight into their own memory
+            if (header_size + header.payload_size > ReceiveBuffer::CAPACITY) {
+                m_receive_buffer.consume(header_size);
+
+                // Everything left in the buffer is part of this payload
+                m_payload_received = m_receive_buffer.size();
+
+                m_current_incoming_message.payload.reserve(header.payload_size, 0);
+                m_receive_buffer.read(m_current_incoming_message.payload.data(), m_payload_received);
+
+                return Received::LargePayload;
+            }
+
+            if (m_receive_buffer.size() < header_size + header.payload_size) {
+                return Received::NeedData;
+            }
+
+            m_receive_buffer.consume(header_size);
+
+            // Small payloads don't allocate
+            m_current_incoming_message.payload.reserve(header.payload_size, 0);
+            m_receive_buffer.read(m_current_incoming_message.payload.data(), header.payload_size);
+
+            if (hello) {
+                return receive_hello();
+            }
+
+            return Received::Message;
+        }
+
+        Connection::Received Connection::receive_hello() {
+            Capabilities capabilities {};
+            std::memcpy(&capabilities, m_current_incoming_message.payload.data(), sizeof(Capabilities));
+
+            m_peer_framing = capabilities & EXTENDED_HEADER_CAPABILITY ? Framing::Extended : Framing::Classic;
+            m_current_incoming_message = {};
+
+            return Received::Hello;
+        }
+
+        void Connection::queue_outgoing(SharedMessage&& message, const SendOptions& options) {
+            OutgoingQueue& queue {m_outgoing_messages[static_cast<std::size_t>(options.priority)]};
+
+            const auto deadline {options.deadline.value_or(std::chrono::steady_clock::time_point::max())};
+
+            if (!options.coalescing_key) {
+                queue.push_back({std::move(message), {}, std::nullopt, deadline});
+                drop_oldest_outgoing(options.priority);
+
+                return;
+            }
+
+            const CoalescingKey key {message.id(), *options.coalescing_key};
+            const auto iter {m_coalescing_messages.find(key)};
+
+            if (iter != m_coalescing_messages.end()) {
+                OutgoingMessage& outgoing {*iter->second.message};
+
+                // Replacing doesn't add a message, so the limits don't apply
+                m_queued_bytes.fetch_add(message.size(), std::memory_order_relaxed);
+                m_queued_bytes.fetch_sub(outgoing.message.size(), std::memory_order_relaxed);
+
+                // It keeps the place in the queue of the old message, unless it's sent with another priority
+                if (iter->second.priority == options.priority) {
+                    outgoing.message = std::move(message);
+                    outgoing.deadline = deadline;
+
+                    return;
+                }
+
+                erase_outgoing(iter->second);
+
+                iter->second = {&queue.emplace_back(OutgoingMessage {std::move(message), {}, key, deadline}), options.priority};
+                drop_oldest_outgoing(options.priority);
+
+                return;
+            }
+
+            if (!check_queue_limits(message.size())) {
+                return;
+            }
+
+            m_coalescing_messages.emplace(
+                key,
+                CoalescingEntry {&queue.emplace_back(OutgoingMessage {std::move(message), {}, key, deadline}), options.priority}
+            );
+            drop_oldest_outgoing(options.priority);
+        }
+
+        bool Connection::has_outgoing_messages() const noexcept {
+            for (const OutgoingQueue& queue : m_outgoing_messages) {
+                if (!queue.empty()) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool Connection::gather_messages() {
+            assert(m_writing_messages.empty());
+
+            m_write_buffers.clear();
+
+            const std::size_t max_buffers {std::min(m_options.max_write_buffers, MAX_WRITE_BUFFERS)};
+            std::size_t size {0};
+            std::array<bool, PRIORITIES> written {};
+
+            const auto now {std::chrono::steady_clock::now()};
+
+            if (!m_hello_sent) {
+                gather_hello(size);
+            }
+
+            // Lanes that have waited for too long get one message in first
+            for (std::size_t i {0}; i < PRIORITIES; i++) {
+                drop_expired_outgoing(m_outgoing_messages[i], now);
+
+                if (m_skipped_writes[i] >= m_options.max_skipped_writes && !m_outgoing_messages[i].empty()) {
+                    switch (writable(m_outgoing_messages[i].front().message.get())) {
+                        case Writable::Yes:
+                            written[i] = gather_message(m_outgoing_messages[i], max_buffers, size);
+                            break;
+                        case Writable::NotYet:
+                            m_holding_back = true;
+                            break;
+                        case Writable::Never:
+                            return false;
+                    }
+                }
+            }
+
+            // Then fill up the rest, starting with the highest priority
+            for (std::size_t i {0}; i < PRIORITIES; i++) {
+                bool full {false};
+
+                while (true) {
+                    drop_expired_outgoing(m_outgoing_messages[i], now);
+
+                    if (m_outgoing_messages[i].empty()) {
+                        break;
+                    }
+
+                    const Writable message_writable {writable(m_outgoing_messages[i].front().message.get())};
+
+                    if (message_writable == Writable::Never) {
+                        return false;
+                    }
+
+                    // Keep the order of the lane, until the framing of the peer is known
+                    if (message_writable == Writable::NotYet) {
+                        m_holding_back = true;
+                        break;
+                    }
+
+                    if (!gather_message(m_outgoing_messages[i], max_buffers, size)) {
+                        full = true;
+                        break;
+                    }
+
+                    written[i] = true;
+                }
+
+                if (full) {
+                    break;
+                }
+            }
+
+            for (std::size_t i {0}; i < PRIORITIES; i++) {
+                if (written[i] || m_outgoing_messages[i].empty()) {
+                    m_skipped_writes[i] = 0;
+                } else {
+                    m_skipped_writes[i]++;
+                }
+            }
+
+            return true;
+        }
+
+        bool Connection::gather_message(OutgoingQueue& queue, std::size_t max_buffers, std::size_t& size) {
+            const Message& message {queue.front().message.get()};
+            const MsgHeader& header {message_header(message)};
+            const std::size_t buffers {header.payload_size > 0 ? 2u : 1u};
+
+            // Always write at least one message
+            if (!m_writing_messages.empty()) {
+                if (m_write_buffers.count() + buffers > max_buffers || size + message.size() > m_options.max_write_size) {
+                    return false;
+                }
+            }
+
+            // Move it first, so that the buffers point to its final place
+            OutgoingMessage& outgoing {m_writing_messages.emplace_back(std::move(queue.front()))};
+            pop_outgoing(queue);
+
+            write_outgoing(outgoing, size);
+
+            return true;
+        }
+
+        void Connection::gather_hello(std::size_t& size) {
+            assert(m_writing_messages.empty());
+
+            Message hello {HELLO_ID};
+            hello << EXTENDED_HEADER_CAPABILITY;
+
+            write_outgoing(
+                m_writing_messages.emplace_back(OutgoingMessage {
+                    SharedMessage(std::move(hello)),
+                    {},
+                    std::nullopt,
+                    std::chrono::steady_clock::time_point::max()
+                }),
+                size
+            );
+
+            m_hello_sent = true;
+            m_writing_hello = true;
+        }
+
+        void Connection::write_outgoing(OutgoingMessage& outgoing, std::size_t& size) {
+            const Message& message {outgoing.message.get()};
+            const MsgHeader& header {message_header(message)};
+
+            outgoing.header = encode_header(header, m_peer_framing == Framing::Extended);
+
+            m_write_buffers.push_back(asio::buffer(outgoing.header.bytes, outgoing.header.size));
+
+            if (header.payload_size > 0) {
+                m_write_buffers.push_back(asio::buffer(message_payload(message), header.payload_size));
+            }
+
+            size += message.size();
+        }
+
+        bool Connection::resume_held_back() noexcept {
+            if (!m_holding_back || m_peer_framing == Framing::Unknown) {
+                return false;
+            }
+
+            m_holding_back = false;
+
+            // Otherwise the ongoing write continues with them; they may also have expired in the meantime
+            return m_writing_messages.empty() && has_outgoing_messages();
+        }
+
+        Connection::Writable Connection::writable(const Message& message) const noexcept {
+            const std::uint32_t payload_size {message_header(message).payload_size};
+
+            if (payload_size < EXTENDED_PAYLOAD_SIZE) {
+                return Writable::Yes;
+            }
+
+            switch (m_peer_framing) {
+                case Framing::Unknown:
+                    return Writable::NotYet;
+                case Framing::Classic:
+                    // The classic header just fits this one
+                    return payload_size == EXTENDED_PAYLOAD_SIZE ? Writable::Yes : Writable::Never;
+                case Framing::Extended:
+                    return Writable::Yes;
+            }
+
+            return Writable::Yes;
+        }
+
+        void Connection::pop_outgoing(OutgoingQueue& queue) {
+            const std::optional<CoalescingKey>& key {queue.front().coalescing_key};
+
+            if (key) {
+                m_coalescing_messages.erase(*key);
+            }
+
+            queue.pop_front();
+        }
+
+        void Connection::erase_outgoing(const CoalescingEntry& entry) {
+            OutgoingQueue& queue {m_outgoing_messages[static_cast<std::size_t>(entry.priority)]};
+
+            const auto iter {std::find_if(queue.begin(), queue.end(), [&entry](const OutgoingMessage& outgoing) {
+                return &outgoing == entry.message;
+            })};
+
+            assert(iter != queue.end());
+
+            queue.erase(iter);
+
+            // Erasing from the middle moves the other messages of the lane
+            for (OutgoingMessage& outgoing : queue) {
+                if (outgoing.coalescing_key) {
+                    m_coalescing_messages.find(*outgoing.coalescing_key)->second.message = &outgoing;
+                }
+            }
+        }
+
+        void Connection::drop_expired_outgoing(OutgoingQueue& queue, std::chrono::steady_clock::time_point now) {
+            while (!queue.empty() && queue.front().deadline <= now) {
+                m_queued_bytes.fetch_sub(queue.front().message.size(), std::memory_order_relaxed);
+                m_queued_messages.fetch_sub(1, std::memory_order_relaxed);
+                m_expired.fetch_add(1, std::memory_order_relaxed);
+
+                pop_outgoing(queue);
+            }
+        }
+
+        void Connection::finish_writing() {
+            // The hello has not been counted in the queue
+            const std::size_t first {m_writing_hello ? 1u : 0u};
+            std::size_t size {0};
+
+            for (std::size_t i {first}; i < m_writing_messages.size(); i++) {
+                size += m_writing_messages[i].message.size();
+            }
+
+            m_queued_bytes.fetch_sub(size, std::memory_order_relaxed);
+            m_queued_messages.fetch_sub(m_writing_messages.size() - first, std::memory_order_relaxed);
+
+            m_writing_messages.clear();
+            m_writing_hello = false;
+        }
+
+        bool Connection::admit_outgoing(std::size_t size, const SendOptions& options) {
+            if (options.coalescing_key) {
+                return true;
+            }
+
+            return check_queue_limits(size);
+        }
+
+        bool Connection::check_queue_limits(std::size_t size) {
+            if (!reserve_queue_space(size)) {
+                switch (m_options.slow_consumer_policy) {
+                    case SlowConsumerPolicy::DropOldest:
+                        // Room is made in the network thread
+                        break;
+                    case SlowConsumerPolicy::DropNewest:
+                        m_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    case SlowConsumerPolicy::Disconnect: {
+                        // Closing takes a while, so don't count the messages sent in the meantime
+                        std::uint64_t expected {0};
+
+                        if (m_disconnects.compare_exchange_strong(expected, 1, std::memory_order_relaxed)) {
+                            close();
+                        }
+
+                        return false;
+                    }
+                    case SlowConsumerPolicy::Backpressure:
+                        m_backpressure.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                }
+
+                m_queued_bytes.fetch_add(size, std::memory_order_relaxed);
+                m_queued_messages.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            return true;
+        }
+
+        bool Connection::reserve_queue_space(std::size_t size) noexcept {
+            // The network thread and any thread sending may race for the last room, so check and reserve at once
+            std::size_t queued_messages {m_queued_messages.load(std::memory_order_relaxed)};
+
+            do {
+                if (queued_messages > 0 && queued_messages + 1 > m_options.max_queued_messages) {
+                    return false;
+                }
+            } while (!m_queued_messages.compare_exchange_weak(queued_messages, queued_messages + 1, std::memory_order_relaxed));
+
+            if (queued_messages == 0) {
+                m_queued_bytes.fetch_add(size, std::memory_order_relaxed);
+                return true;
+            }
+
+            std::size_t queued_bytes {m_queued_bytes.load(std::memory_order_relaxed)};
+
+            do {
+                if (queued_bytes + size > m_options.max_queued_bytes) {
+                    // Give the message back; a concurrent sender may have been refused because of it meanwhile
+                    m_queued_messages.fetch_sub(1, std::memory_order_relaxed);
+                    return false;
+                }
+            } while (!m_queued_bytes.compare_exchange_weak(queued_bytes, queued_bytes + size, std::memory_order_relaxed));
+
+            return true;
+        }
+
+        void Connection::drop_oldest_outgoing(Priority priority) {
+            if (m_options.slow_consumer_policy != SlowConsumerPolicy::DropOldest) {
+                return;
+            }
+
+            // Start with the lowest priority; messages being written cannot be dropped
+            for (std::size_t i {PRIORITIES}; i-- > 0;) {
+                OutgoingQueue& queue {m_outgoing_messages[i]};
+                const std::size_t keep {i == static_cast<std::size_t>(priority) ? 1u : 0u};
+
+                while (queue.size() > keep) {
+                    const std::size_t queued_messages {m_queued_messages.load(std::memory_order_relaxed)};
+                    const std::size_t queued_bytes {m_queued_bytes.load(std::memory_order_relaxed)};
+
+                    if (queued_messages <= m_options.max_queued_messages && queued_bytes <= m_options.max_queued_bytes) {
+                        return;
+                    }
+
+                    m_queued_bytes.fetch_sub(queue.front().message.size(), std::memory_order_relaxed);
+                    m_queued_messages.fetch_sub(1, std::memory_order_relaxed);
+                    m_dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+
+                    pop_outgoing(queue);
+                }
+            }
+        }
+
+        SlowConsumerStatistics Connection::get_slow_consumer_statistics() const noexcept {
+            SlowConsumerStatistics statistics;
+            statistics.dropped_oldest = m_dropped_oldest.load(std::memory_order_relaxed);
+            statistics.dropped_newest = m_dropped_newest.load(std::memory_order_relaxed);
+            statistics.disconnects = m_disconnects.load(std::memory_order_relaxed);
+            statistics.backpressure = m_backpressure.load(std::memory_order_relaxed);
+            statistics.expired = m_expired.load(std::memory_order_relaxed);
+
+            return statistics;
         }
     }
 }
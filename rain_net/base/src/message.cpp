@@ -2,48 +2,113 @@
 
 #include <utility>
 #include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+#include "rain_net/internal/buffer_pool.hpp"
 
 namespace rain_net {
     namespace internal {
-        BasicMessage clone_message(const Message& message) {
-            internal::BasicMessage result;
-            result.header = message.m_header;
-            result.payload = std::make_unique<unsigned char[]>(message.m_header.payload_size);
-            std::memcpy(result.payload.get(), message.m_payload.get(), message.m_header.payload_size);
+        std::size_t header_size(std::uint32_t payload_size) noexcept {
+            return payload_size < EXTENDED_PAYLOAD_SIZE ? HEADER_SIZE : EXTENDED_HEADER_SIZE;
+        }
+
+        WireHeader encode_header(const MsgHeader& header, bool extended) noexcept {
+            assert(extended || header.payload_size <= EXTENDED_PAYLOAD_SIZE);
+
+            WireHeader result;
+            result.size = extended ? header_size(header.payload_size) : HEADER_SIZE;
+
+            std::memcpy(result.bytes, &header.id, sizeof(std::uint16_t));
+
+            if (result.size == HEADER_SIZE) {
+                const auto payload_size {static_cast<std::uint16_t>(header.payload_size)};
+                std::memcpy(result.bytes + 2, &payload_size, sizeof(std::uint16_t));
+            } else {
+                std::memcpy(result.bytes + 2, &EXTENDED_PAYLOAD_SIZE, sizeof(std::uint16_t));
+                std::memcpy(result.bytes + 4, &header.payload_size, sizeof(std::uint32_t));
+            }
 
             return result;
         }
+
+        bool decode_header(const unsigned char* bytes, MsgHeader& header) noexcept {
+            std::uint16_t payload_size {};
+
+            std::memcpy(&header.id, bytes, sizeof(std::uint16_t));
+            std::memcpy(&payload_size, bytes + 2, sizeof(std::uint16_t));
+
+            header.payload_size = payload_size;
+
+            return payload_size == EXTENDED_PAYLOAD_SIZE;
+        }
+
+        void decode_extended_size(const unsigned char* bytes, MsgHeader& header) noexcept {
+            std::memcpy(&header.payload_size, bytes, sizeof(std::uint32_t));
+        }
+
+        const MsgHeader& message_header(const Message& message) noexcept {
+            return message.m_header;
+        }
+
+        const unsigned char* message_payload(const Message& message) noexcept {
+            return message.m_payload.data();
+        }
     }
 
     Message::Message(std::uint16_t id) noexcept {
         m_header.id = id;
     }
 
-    Message::Message(internal::MsgHeader header, std::unique_ptr<unsigned char[]>&& payload) noexcept
-        : m_header(header), m_payload(std::move(payload)) {}
+    Message::Message(internal::BasicMessage&& message) noexcept
+        : m_header(message.header), m_payload(std::move(message.payload)) {}
 
     Message::Message(const Message& other) {
-        if (other.m_payload != nullptr) {
-            m_payload = std::make_unique<unsigned char[]>(other.m_header.payload_size);
-            std::memcpy(m_payload.get(), other.m_payload.get(), other.m_header.payload_size);
-        }
+        m_payload.reserve(other.m_header.payload_size, 0);
+        std::memcpy(m_payload.data(), other.m_payload.data(), other.m_header.payload_size);
 
         m_header = other.m_header;
     }
 
     Message& Message::operator=(const Message& other) {
-        if (other.m_payload != nullptr) {
-            m_payload = std::make_unique<unsigned char[]>(other.m_header.payload_size);
-            std::memcpy(m_payload.get(), other.m_payload.get(), other.m_header.payload_size);
+        if (this == &other) {
+            return *this;
         }
 
+        // Reuse the current buffer, if it's big enough
+        m_payload.reserve(other.m_header.payload_size, 0);
+        std::memcpy(m_payload.data(), other.m_payload.data(), other.m_header.payload_size);
+
         m_header = other.m_header;
 
         return *this;
     }
 
+    Message::Message(Message&& other) noexcept
+        : m_header(std::exchange(other.m_header, {})), m_payload(std::move(other.m_payload)) {}
+
+    Message& Message::operator=(Message&& other) noexcept {
+        m_header = std::exchange(other.m_header, {});
+        m_payload = std::move(other.m_payload);
+
+        return *this;
+    }
+
     std::size_t Message::size() const noexcept {
-        return sizeof(internal::MsgHeader) + m_header.payload_size;
+        return internal::header_size(m_header.payload_size) + m_header.payload_size;
+    }
+
+    std::size_t Message::capacity() const noexcept {
+        return m_payload.capacity();
+    }
+
+    void Message::reserve(std::size_t capacity) {
+        m_payload.reserve(capacity, m_header.payload_size);
+    }
+
+    void Message::shrink_to_fit() {
+        m_payload.shrink_to_fit(m_header.payload_size);
     }
 
     std::uint16_t Message::id() const noexcept {
@@ -51,32 +116,64 @@ namespace rain_net {
     }
 
     Message& Message::write(const void* data, std::size_t size) {
+        check_payload_size(0, size);
+
         const std::size_t write_position {m_header.payload_size};
 
-        resize(size);
-        std::memcpy(m_payload.get() + write_position, data, size);
+        if (write_position + size > m_payload.capacity()) {
+            grow(write_position + size);
+        }
+
+        std::memcpy(m_payload.data() + write_position, data, size);
+        m_header.payload_size = static_cast<std::uint32_t>(write_position + size);
 
         return *this;
     }
 
-    void Message::resize(std::size_t additional_size) {
-        const std::size_t old_payload_size {m_header.payload_size};
-        const auto old_payload {std::move(m_payload)};
-        const std::size_t new_payload_size {m_header.payload_size + additional_size};
+    Message& Message::write_string(std::string_view string) {
+        check_payload_size(sizeof(internal::ArraySize), string.size());
 
-        m_payload = std::make_unique<unsigned char[]>(new_payload_size);
+        *this << static_cast<internal::ArraySize>(string.size());
 
-        if (old_payload != nullptr) {
-            std::memcpy(m_payload.get(), old_payload.get(), old_payload_size);
+        return write(string.data(), string.size());
+    }
+
+    void Message::check_payload_size(std::size_t prefix_size, std::size_t count, std::size_t item_size) const {
+        // The payload is never bigger than the maximum, so this doesn't overflow
+        const std::size_t available {internal::MAX_PAYLOAD_SIZE - m_header.payload_size};
+
+        if (prefix_size > available || count > (available - prefix_size) / item_size) {
+            throw std::length_error("Message payload too large");
         }
+    }
 
-        m_header.payload_size = static_cast<std::uint16_t>(new_payload_size);
+    void Message::grow(std::size_t required_capacity) {
+        // Grow geometrically, so that writing many fields costs amortized constant time
+        m_payload.reserve(std::max(required_capacity, m_payload.capacity() * 2), m_header.payload_size);
+    }
+
+    SharedMessage::SharedMessage(const Message& message)
+        : m_message(std::allocate_shared<const Message>(internal::PoolAllocator<Message>(), message)) {}
+
+    SharedMessage::SharedMessage(Message&& message)
+        : m_message(std::allocate_shared<const Message>(internal::PoolAllocator<Message>(), std::move(message))) {}
+
+    std::size_t SharedMessage::size() const noexcept {
+        return m_message->size();
+    }
+
+    std::uint16_t SharedMessage::id() const noexcept {
+        return m_message->id();
+    }
+
+    const Message& SharedMessage::get() const noexcept {
+        return *m_message;
     }
 
     MessageReader& MessageReader::read(void* data, std::size_t size) noexcept {
         const std::size_t read_position {m_pointer - size};
 
-        std::memcpy(data, m_message->m_payload.get() + read_position, size);
+        std::memcpy(data, m_message->m_payload.data() + read_position, size);
         m_pointer = read_position;
 
         return *this;
@@ -88,4 +185,62 @@ namespace rain_net {
 
         return *this;
     }
+
+    ForwardMessageReader& ForwardMessageReader::read(void* data, std::size_t size) noexcept {
+        const unsigned char* source {view(size)};
+
+        if (source == nullptr) {
+            std::memset(data, 0, size);
+            return *this;
+        }
+
+        std::memcpy(data, source, size);
+
+        return *this;
+    }
+
+    const unsigned char* ForwardMessageReader::view(std::size_t size) noexcept {
+        if (m_failed || size > remaining()) {
+            m_failed = true;
+            return nullptr;
+        }
+
+        const unsigned char* data {m_message->m_payload.data() + m_pointer};
+        m_pointer += size;
+
+        return data;
+    }
+
+    std::string_view ForwardMessageReader::view_string(std::size_t size) noexcept {
+        const unsigned char* data {view(size)};
+
+        if (data == nullptr) {
+            return {};
+        }
+
+        return std::string_view(reinterpret_cast<const char*>(data), size);
+    }
+
+    std::string_view ForwardMessageReader::read_string() noexcept {
+        internal::ArraySize size {};
+        *this >> size;
+
+        return view_string(size);
+    }
+
+    std::size_t ForwardMessageReader::remaining() const noexcept {
+        return m_message->m_header.payload_size - m_pointer;
+    }
+
+    bool ForwardMessageReader::good() const noexcept {
+        return !m_failed;
+    }
+
+    ForwardMessageReader& ForwardMessageReader::operator()(const Message& message) noexcept {
+        m_message = &message;
+        m_pointer = 0;
+        m_failed = false;
+
+        return *this;
+    }
 }
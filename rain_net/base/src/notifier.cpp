@@ -0,0 +1,73 @@
+#include "rain_net/internal/notifier.hpp"
+
+#ifdef __linux__
+    #include <sys/eventfd.h>
+    #include <unistd.h>
+#endif
+
+#include <cstdint>
+
+namespace rain_net {
+    namespace internal {
+        Notifier::~Notifier() {
+#ifdef __linux__
+            const int handle {m_event_handle.load()};
+
+            if (handle != INVALID_HANDLE) {
+                ::close(handle);
+            }
+#endif
+        }
+
+        int Notifier::event_handle() {
+#ifdef __linux__
+            int handle {m_event_handle.load()};
+
+            if (handle != INVALID_HANDLE) {
+                return handle;
+            }
+
+            handle = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if (handle < 0) {
+                return INVALID_HANDLE;
+            }
+
+            int expected {INVALID_HANDLE};
+
+            // Another thread may have been faster
+            if (!m_event_handle.compare_exchange_strong(expected, handle)) {
+                ::close(handle);
+                return expected;
+            }
+
+            // There may already be work that nobody has been notified about
+            signal_event();
+
+            return handle;
+#else
+            return INVALID_HANDLE;
+#endif
+        }
+
+        void Notifier::signal_event() {
+#ifdef __linux__
+            if (m_event_signaled.exchange(true)) {
+                return;
+            }
+
+            const std::uint64_t value {1};
+            [[maybe_unused]] const auto result {::write(m_event_handle.load(), &value, sizeof(value))};
+#endif
+        }
+
+        void Notifier::clear_event() {
+#ifdef __linux__
+            std::uint64_t value {};
+            [[maybe_unused]] const auto result {::read(m_event_handle.load(), &value, sizeof(value))};
+
+            m_event_signaled.store(false);
+#endif
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#include "rain_net/internal/payload.hpp"
+
+#include <utility>
+#include <cstring>
+
+#include "rain_net/internal/buffer_pool.hpp"
+
+namespace rain_net {
+    namespace internal {
+        Payload::~Payload() noexcept {
+            BufferPool::deallocate(m_heap, m_capacity);
+        }
+
+        Payload::Payload(Payload&& other) noexcept
+            : m_heap(std::exchange(other.m_heap, nullptr)), m_capacity(std::exchange(other.m_capacity, INLINE_PAYLOAD_SIZE)) {
+            if (m_heap == nullptr) {
+                std::memcpy(m_inline, other.m_inline, INLINE_PAYLOAD_SIZE);
+            }
+        }
+
+        Payload& Payload::operator=(Payload&& other) noexcept {
+            if (this == &other) {
+                return *this;
+            }
+
+            BufferPool::deallocate(m_heap, m_capacity);
+
+            m_heap = std::exchange(other.m_heap, nullptr);
+            m_capacity = std::exchange(other.m_capacity, INLINE_PAYLOAD_SIZE);
+
+            if (m_heap == nullptr) {
+                std::memcpy(m_inline, other.m_inline, INLINE_PAYLOAD_SIZE);
+            }
+
+            return *this;
+        }
+
+        unsigned char* Payload::data() noexcept {
+            return m_heap != nullptr ? m_heap : m_inline;
+        }
+
+        const unsigned char* Payload::data() const noexcept {
+            return m_heap != nullptr ? m_heap : m_inline;
+        }
+
+        std::size_t Payload::capacity() const noexcept {
+            return m_capacity;
+        }
+
+        void Payload::reserve(std::size_t capacity, std::size_t size) {
+            if (capacity > m_capacity) {
+                reallocate(capacity, size);
+            }
+        }
+
+        void Payload::shrink_to_fit(std::size_t size) {
+            if (m_heap == nullptr) {
+                return;
+            }
+
+            if (size <= INLINE_PAYLOAD_SIZE) {
+                std::memcpy(m_inline, m_heap, size);
+                BufferPool::deallocate(std::exchange(m_heap, nullptr), m_capacity);
+                m_capacity = INLINE_PAYLOAD_SIZE;
+            } else if (BufferPool::buffer_size(size) < m_capacity) {
+                reallocate(size, size);
+            }
+        }
+
+        void Payload::reallocate(std::size_t capacity, std::size_t size) {
+            // Use all the space of the buffer that we get anyway
+            const std::size_t buffer_size {BufferPool::buffer_size(capacity)};
+
+            const auto heap {static_cast<unsigned char*>(BufferPool::allocate(buffer_size))};
+            std::memcpy(heap, data(), size);
+
+            BufferPool::deallocate(m_heap, m_capacity);
+
+            m_heap = heap;
+            m_capacity = buffer_size;
+        }
+    }
+}
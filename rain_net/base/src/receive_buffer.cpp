@@ -0,0 +1,93 @@
+#include "rain_net/internal/receive_buffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+namespace rain_net {
+    namespace internal {
+        ReceiveBuffer::ReceiveBuffer(ReceiveSlab* slab) {
+            if (slab != nullptr) {
+                if (const auto buffer {slab->allocate()}) {
+                    m_slab = slab;
+                    m_registered_buffer = *buffer;
+                    m_buffer = static_cast<unsigned char*>(buffer->data());
+
+                    return;
+                }
+            }
+
+            m_own_buffer = std::make_unique<unsigned char[]>(CAPACITY);
+            m_buffer = m_own_buffer.get();
+        }
+
+        ReceiveBuffer::~ReceiveBuffer() {
+            if (m_slab != nullptr) {
+                m_slab->deallocate(m_registered_buffer);
+            }
+        }
+
+        std::array<asio::mutable_buffer, 2> ReceiveBuffer::free_space() noexcept {
+            const std::size_t position {m_write_position & MASK};
+            const std::size_t free {CAPACITY - size()};
+            const std::size_t first {std::min(free, CAPACITY - position)};
+
+            return {
+                asio::buffer(m_buffer + position, first),
+                asio::buffer(m_buffer, free - first)
+            };
+        }
+
+        std::optional<asio::mutable_registered_buffer> ReceiveBuffer::registered_free_space() const noexcept {
+            if (m_slab == nullptr) {
+                return std::nullopt;
+            }
+
+            const std::size_t position {m_write_position & MASK};
+            const std::size_t free {CAPACITY - size()};
+
+            if (position + free > CAPACITY) {
+                return std::nullopt;
+            }
+
+            return asio::buffer(m_registered_buffer + position, free);
+        }
+
+        void ReceiveBuffer::produce(std::size_t size) noexcept {
+            m_write_position += size;
+
+            assert(this->size() <= CAPACITY);
+        }
+
+        std::size_t ReceiveBuffer::size() const noexcept {
+            return m_write_position - m_read_position;
+        }
+
+        void ReceiveBuffer::peek(void* data, std::size_t size) const noexcept {
+            assert(size <= this->size());
+
+            const std::size_t position {m_read_position & MASK};
+            const std::size_t first {std::min(size, CAPACITY - position)};
+
+            std::memcpy(data, m_buffer + position, first);
+            std::memcpy(static_cast<unsigned char*>(data) + first, m_buffer, size - first);
+        }
+
+        void ReceiveBuffer::read(void* data, std::size_t size) noexcept {
+            peek(data, size);
+            consume(size);
+        }
+
+        void ReceiveBuffer::consume(std::size_t size) noexcept {
+            assert(size <= this->size());
+
+            m_read_position += size;
+
+            // Start over when empty, so that the next receive is more likely to get a single contiguous buffer
+            if (m_read_position == m_write_position) {
+                m_read_position = 0;
+                m_write_position = 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#include "rain_net/internal/receive_slab.hpp"
+
+#include <cassert>
+
+namespace rain_net {
+    namespace internal {
+        ReceiveSlab::ReceiveSlab(asio::io_context& asio_context, std::size_t buffers, std::size_t buffer_size)
+            : m_buffer_size(buffer_size), m_memory(std::make_unique<unsigned char[]>(buffers * buffer_size)),
+            m_registration(asio::register_buffers(asio_context, asio::buffer(m_memory.get(), buffers * buffer_size))) {
+            m_free.reserve(buffers);
+
+            // Hand out the lower addresses first
+            for (std::size_t i {buffers}; i-- > 0;) {
+                m_free.push_back(i);
+            }
+        }
+
+        std::optional<asio::mutable_registered_buffer> ReceiveSlab::allocate() {
+            std::lock_guard<std::mutex> lock {m_mutex};
+
+            if (m_free.empty()) {
+                return std::nullopt;
+            }
+
+            const std::size_t index {m_free.back()};
+            m_free.pop_back();
+
+            return asio::buffer(m_registration[0] + index * m_buffer_size, m_buffer_size);
+        }
+
+        void ReceiveSlab::deallocate(const asio::mutable_registered_buffer& buffer) {
+            const auto offset {static_cast<unsigned char*>(buffer.data()) - m_memory.get()};
+
+            assert(offset >= 0 && static_cast<std::size_t>(offset) % m_buffer_size == 0);
+
+            std::lock_guard<std::mutex> lock {m_mutex};
+
+            m_free.push_back(static_cast<std::size_t>(offset) / m_buffer_size);
+        }
+    }
+}
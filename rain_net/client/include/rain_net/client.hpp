@@ -5,6 +5,13 @@
 #include <string_view>
 #include <cstdint>
 #include <exception>
+#include <vector>
+#include <cstddef>
+#include <limits>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <functional>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic push
@@ -17,7 +24,9 @@
     #pragma GCC diagnostic pop
 #endif
 
-#include "rain_net/internal/queue.hpp"
+#include "rain_net/internal/spsc_queue.hpp"
+#include "rain_net/internal/notifier.hpp"
+#include "rain_net/internal/receive_slab.hpp"
 #include "rain_net/internal/message.hpp"
 #include "rain_net/internal/server_connection.hpp"
 
@@ -38,8 +47,19 @@ namespace rain_net {
 
         // Start the client's internal event loop and connect to the server
         // You may call this only once in the beginning or after calling disconnect()
+        // Optionally specify options for tuning the connection
         // Throws connection errors
-        void connect(std::string_view host, std::uint16_t port);
+        void connect(std::string_view host, std::uint16_t port, const ConnectionOptions& options = {});
+
+        // Handle incoming messages right in the internal thread, instead of queueing them for next_message()
+        // This skips the hop to the main thread, for services where that latency matters
+        // You may call this only before connect(); pass an empty function to go back to the queue
+        // Threading rules for the callback:
+        //   It runs in the internal thread, one message at a time, in order
+        //   It must be quick, as receiving and sending wait for it
+        //   It may reply with send_message(), but it must not call any other Client method
+        //   It must not throw
+        void set_on_message(std::function<void(Message)> on_message);
 
         // Disconnect from the server and stop the internal event loop
         // You may call this at any time
@@ -52,6 +72,11 @@ namespace rain_net {
         // Throws connection errors
         bool connection_established();
 
+        // After a call to connect(), block until the connection is established or until the timeout expires
+        // Use this instead of calling connection_established() in a loop
+        // Throws connection errors
+        bool wait_for_connection(std::chrono::nanoseconds timeout);
+
         // Poll the next incoming message from the queue
         // You may call it in a loop to process as many messages as you want
         Message next_message();
@@ -59,19 +84,48 @@ namespace rain_net {
         // Check if there are available incoming messages
         bool available_messages() const;
 
+        // Block until there are incoming messages, or until the timeout expires
+        // Optionally spin for a while before sleeping, which reacts faster, but burns CPU
+        // Returns early also when an error occurred; the next call that throws errors will throw it
+        // Returns true, if there are available messages
+        bool wait_for_messages(std::chrono::nanoseconds timeout, std::chrono::nanoseconds spin = {});
+
+        // Get a handle that becomes readable when there are incoming messages
+        // Use it to integrate the client into another event loop, like epoll (it's an eventfd on Linux)
+        // It stays readable until draining the incoming messages leaves nothing to process
+        // Don't read from it and don't close it
+        // Returns -1, if it's not supported on this platform
+        int event_handle();
+
+        // Take all the available incoming messages at once, but at most max, appending them to the vector
+        // Returns the amount of messages taken
+        std::size_t drain_messages(std::vector<Message>& messages, std::size_t max = std::numeric_limits<std::size_t>::max());
+
         // Send a message to the server
+        // Optionally specify the priority and other options for sending
         // Does not send anything, if the connection is not established
+        // Returns false, if the message has not been queued, because the server is not keeping up
+        // (see ConnectionOptions::slow_consumer_policy) or because there is no connection
         // Throws connection errors
-        void send_message(const Message& message);
+        bool send_message(const Message& message, const SendOptions& options = {});
+
+        // Get how many times the slow consumer policy has been applied on the connection
+        SlowConsumerStatistics slow_consumer_statistics() const;
     private:
         void throw_if_error();
+        void set_error(std::exception_ptr error);
+        void reset_event();
 
         std::unique_ptr<ServerConnection> m_connection;
-        internal::SyncQueue<Message> m_incoming_messages;
+        internal::SpscQueue<Message> m_incoming_messages;
+        internal::Notifier m_notifier;
+        std::function<void(Message)> m_on_message;
 
         std::thread m_context_thread;
         asio::io_context m_asio_context;
+        std::optional<internal::ReceiveSlab> m_receive_slab;  // Only for io_uring
 
         std::exception_ptr m_error;
+        std::atomic_bool m_error_occurred {false};  // Set after m_error, as m_error is written by the event loop thread
     };
 }
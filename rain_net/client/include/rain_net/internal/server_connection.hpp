@@ -2,6 +2,7 @@
 
 #include <utility>
 #include <atomic>
+#include <functional>
 
 #include "rain_net/internal/connection.hpp"
 
@@ -14,28 +15,44 @@ namespace rain_net {
         ServerConnection(
             asio::io_context& asio_context,
             asio::ip::tcp::socket&& tcp_socket,
-            internal::SyncQueue<Message>& incoming_messages,
-            const asio::ip::tcp::resolver::results_type& endpoints
+            internal::SpscQueue<Message>& incoming_messages,
+            internal::Notifier& notifier,
+            const asio::ip::tcp::resolver::results_type& endpoints,
+            const std::function<void(Message)>& on_message,
+            const ConnectionOptions& options,
+            internal::ReceiveSlab* receive_slab = nullptr
         )
-            : internal::Connection(asio_context, std::move(tcp_socket)), m_incoming_messages(incoming_messages),
-            m_endpoints(endpoints) {}
+            : internal::Connection(asio_context, std::move(tcp_socket), options, receive_slab), m_incoming_messages(incoming_messages),
+            m_notifier(notifier), m_endpoints(endpoints), m_on_message(on_message) {}
 
         // Send a message asynchronously
-        void send(const Message& message);
+        // Returns false, if the message has not been queued, because of the slow consumer policy
+        bool send(const Message& message, const SendOptions& options = {});
+
+        // Send a shared message asynchronously; the payload is not copied
+        // Returns false, if the message has not been queued, because of the slow consumer policy
+        bool send(const SharedMessage& message, const SendOptions& options = {});
+
+        // Get how many times the slow consumer policy has been applied
+        SlowConsumerStatistics slow_consumer_statistics() const noexcept;
     private:
         void connect();
         bool connection_established() const noexcept;
         void add_to_incoming_messages();
+        void read_messages();
 
         void task_write_message();
-        void task_read_header();
+        void task_write_buffers();
+        void task_read();
         void task_read_payload();
-        void task_send_message(const Message& message);
+        void task_send_message(SharedMessage message, const SendOptions& options);
         void task_connect_to_server();
 
-        internal::SyncQueue<Message>& m_incoming_messages;
+        internal::SpscQueue<Message>& m_incoming_messages;
+        internal::Notifier& m_notifier;
         std::atomic_bool m_established_connection {false};
         asio::ip::tcp::resolver::results_type m_endpoints;
+        const std::function<void(Message)>& m_on_message;  // Bypasses the queue, if set
 
         friend class Client;
     };
@@ -3,6 +3,8 @@
 #include <string>
 #include <stdexcept>
 #include <utility>
+#include <cassert>
+#include <system_error>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic push
@@ -23,7 +25,7 @@ namespace rain_net {
         disconnect();
     }
 
-    void Client::connect(std::string_view host, std::uint16_t port) {
+    void Client::connect(std::string_view host, std::uint16_t port, const ConnectionOptions& options) {
         if (m_asio_context.stopped()) {
             m_asio_context.restart();
         }
@@ -38,11 +40,24 @@ namespace rain_net {
             throw ConnectionError(e.what());
         }
 
+        // The event loop lives as long as the client, so register the receive buffer only once
+        if (internal::IO_URING && !m_receive_slab) {
+            try {
+                m_receive_slab.emplace(m_asio_context, 1, internal::ReceiveBuffer::CAPACITY);
+            } catch (const std::system_error&) {
+                // The connection uses its own buffer then
+            }
+        }
+
         m_connection = std::make_unique<ServerConnection>(
             m_asio_context,
             asio::ip::tcp::socket(m_asio_context),
             m_incoming_messages,
-            endpoints
+            m_notifier,
+            endpoints,
+            m_on_message,
+            options,
+            m_receive_slab ? &*m_receive_slab : nullptr
         );
 
         m_connection->connect();
@@ -51,13 +66,19 @@ namespace rain_net {
             try {
                 m_asio_context.run();
             } catch (const std::system_error& e) {
-                m_error = std::make_exception_ptr(ConnectionError(e.what()));
+                set_error(std::make_exception_ptr(ConnectionError(e.what())));
             } catch (const ConnectionError& e) {
-                m_error = std::current_exception();
+                set_error(std::current_exception());
             }
         });
     }
 
+    void Client::set_on_message(std::function<void(Message)> on_message) {
+        assert(m_connection == nullptr);
+
+        m_on_message = std::move(on_message);
+    }
+
     void Client::disconnect() {
         // Don't prime the context, if it has been stopped,
         // because it will do the work after restart, meaning use after free
@@ -86,30 +107,94 @@ namespace rain_net {
         return m_connection->connection_established();
     }
 
+    bool Client::wait_for_connection(std::chrono::nanoseconds timeout) {
+        throw_if_error();
+
+        if (m_connection == nullptr) {
+            return false;
+        }
+
+        m_notifier.wait(timeout, {}, [this]() {
+            return m_connection->connection_established() || m_error_occurred.load(std::memory_order_acquire);
+        });
+
+        return connection_established();
+    }
+
     Message Client::next_message() {
-        return m_incoming_messages.pop_front();
+        auto message {m_incoming_messages.pop_front()};
+
+        if (m_incoming_messages.empty()) {
+            reset_event();
+        }
+
+        return message;
     }
 
     bool Client::available_messages() const {
         return !m_incoming_messages.empty();
     }
 
-    void Client::send_message(const Message& message) {
+    bool Client::wait_for_messages(std::chrono::nanoseconds timeout, std::chrono::nanoseconds spin) {
+        return m_notifier.wait(timeout, spin, [this]() {
+            return !m_incoming_messages.empty() || m_error_occurred.load(std::memory_order_acquire);
+        }) && !m_error_occurred.load(std::memory_order_acquire);
+    }
+
+    std::size_t Client::drain_messages(std::vector<Message>& messages, std::size_t max) {
+        const std::size_t count {m_incoming_messages.pop_front(messages, max)};
+
+        if (m_incoming_messages.empty()) {
+            reset_event();
+        }
+
+        return count;
+    }
+
+    int Client::event_handle() {
+        return m_notifier.event_handle();
+    }
+
+    bool Client::send_message(const Message& message, const SendOptions& options) {
         throw_if_error();
 
         if (m_connection == nullptr) {
-            return;
+            return false;
         }
 
-        m_connection->send(message);
+        return m_connection->send(message, options);
+    }
+
+    SlowConsumerStatistics Client::slow_consumer_statistics() const {
+        if (m_connection == nullptr) {
+            return {};
+        }
+
+        return m_connection->slow_consumer_statistics();
     }
 
     void Client::throw_if_error() {
-        if (m_error) {
+        if (m_error_occurred.load(std::memory_order_acquire)) {
             disconnect();
 
+            m_error_occurred.store(false);
+
             const auto error {std::exchange(m_error, nullptr)};
             std::rethrow_exception(error);
         }
     }
+
+    void Client::reset_event() {
+        m_notifier.reset_event([this]() {
+            return !m_incoming_messages.empty();
+        });
+    }
+
+    void Client::set_error(std::exception_ptr error) {
+        m_error = std::move(error);
+        m_error_occurred.store(true, std::memory_order_release);
+
+        // Wake up the main thread, so that it can see the error
+        m_notifier.notify();
+    }
 }
@@ -10,8 +10,8 @@
 
 #include <asio/buffer.hpp>
 #include <asio/read.hpp>
-#include <asio/write.hpp>
 #include <asio/post.hpp>
+#include <asio/bind_allocator.hpp>
 #include <asio/connect.hpp>
 #include <asio/error_code.hpp>
 
@@ -20,11 +20,33 @@
 #endif
 
 #include "rain_net/internal/error.hpp"
+#include "rain_net/internal/buffer_pool.hpp"
 #include "rain_net/conversion.hpp"  // TODO
 
 namespace rain_net {
-    void ServerConnection::send(const Message& message) {
-        task_send_message(message);
+    bool ServerConnection::send(const Message& message, const SendOptions& options) {
+        // Don't copy the message, if it's not going to be queued
+        if (!admit_outgoing(message.size(), options)) {
+            return false;
+        }
+
+        task_send_message(SharedMessage(message), options);
+
+        return true;
+    }
+
+    bool ServerConnection::send(const SharedMessage& message, const SendOptions& options) {
+        if (!admit_outgoing(message.size(), options)) {
+            return false;
+        }
+
+        task_send_message(message, options);
+
+        return true;
+    }
+
+    SlowConsumerStatistics ServerConnection::slow_consumer_statistics() const noexcept {
+        return get_slow_consumer_statistics();
     }
 
     void ServerConnection::connect() {
@@ -36,112 +58,172 @@ namespace rain_net {
     }
 
     void ServerConnection::add_to_incoming_messages() {
-        m_incoming_messages.push_back(Message(m_current_incoming_message.header, std::move(m_current_incoming_message.payload)));
+        Message message {std::move(m_current_incoming_message)};
 
         m_current_incoming_message = {};
+
+        // Hand it over right here in the network thread
+        if (m_on_message) {
+            m_on_message(std::move(message));
+            return;
+        }
+
+        m_incoming_messages.push_back(std::move(message));
+        m_notifier.notify();
     }
 
     void ServerConnection::task_write_message() {
-        assert(!m_outgoing_messages.empty());
+        assert(has_outgoing_messages() || !m_hello_sent);
 
-        std::vector<asio::const_buffer> buffers;
-        buffers.emplace_back(&m_outgoing_messages.front().header, sizeof(internal::MsgHeader));
+        // Write as many queued messages as possible at once
+        if (!gather_messages()) {
+            close_socket();
 
-        if (m_outgoing_messages.front().header.payload_size > 0) {
-            buffers.emplace_back(m_outgoing_messages.front().payload.get(), m_outgoing_messages.front().header.payload_size);
+            throw ConnectionError("Message too large for the peer, which doesn't support the extended header");
         }
 
-        const std::size_t size {internal::buffers_size(buffers)};
+        // Everything may have expired
+        if (m_writing_messages.empty()) {
+            return;
+        }
 
-        asio::async_write(m_tcp_socket, buffers,
-            [this, size](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
+        task_write_buffers();
+    }
+
+    void ServerConnection::task_write_buffers() {
+        m_tcp_socket.async_write_some(m_write_buffers,
+            [this](asio::error_code ec, std::size_t bytes_transferred) {
                 if (ec) {
-                    m_tcp_socket.close();
+                    close_socket();
 
-                    throw ConnectionError("Could not write message: " + ec.message());
+                    throw ConnectionError("Could not write messages: " + ec.message());
                 }
 
-                assert(bytes_transferred == size);
+                m_write_buffers.consume(bytes_transferred);
 
-                m_outgoing_messages.pop_front();
+                // Continue, if not everything has been written
+                if (m_write_buffers.count() > 0) {
+                    task_write_buffers();
+                    return;
+                }
+
+                finish_writing();
 
                 // Thus writing tasks can stop
-                if (!m_outgoing_messages.empty()) {
+                if (has_outgoing_messages()) {
                     task_write_message();
                 }
             }
         );
     }
 
-    void ServerConnection::task_read_header() {
-        asio::async_read(m_tcp_socket, asio::buffer(&m_current_incoming_message.header, sizeof(internal::MsgHeader)),
-            [this](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
-                if (ec) {
-                    m_tcp_socket.close();
+    void ServerConnection::read_messages() {
+        // Handle every message that has been received so far
+        while (true) {
+            const Received received {receive_message()};
 
-                    throw ConnectionError("Could not read header: " + ec.message());
-                }
+            // The first message of the peer tells if it can take the messages that have been held back
+            if (resume_held_back()) {
+                task_write_message();
+            }
 
-                assert(bytes_transferred == sizeof(internal::MsgHeader));
+            switch (received) {
+                case Received::Message:
+                    add_to_incoming_messages();
+                    break;
+                case Received::NeedData:
+                    task_read();
+                    return;
+                case Received::LargePayload:
+                    task_read_payload();
+                    return;
+                case Received::Hello:
+                    break;
+                case Received::TooLarge:
+                    close_socket();
 
-                // Check if there is a payload to read
-                if (m_current_incoming_message.header.payload_size > 0) {
-                    // Allocate space so that we write to it later
-                    m_current_incoming_message.payload = std::make_unique<unsigned char[]>(m_current_incoming_message.header.payload_size);
+                    throw ConnectionError("Message too large: " + std::to_string(m_current_incoming_message.header.payload_size));
+            }
+        }
+    }
 
-                    task_read_payload();
-                } else {
-                    add_to_incoming_messages();
-                    task_read_header();
-                }
+    void ServerConnection::task_read() {
+        auto handler {[this](asio::error_code ec, std::size_t bytes_transferred) {
+            if (ec) {
+                close_socket();
+
+                throw ConnectionError("Could not read: " + ec.message());
             }
-        );
+
+            m_receive_buffer.produce(bytes_transferred);
+
+            read_messages();
+        }};
+
+        // With io_uring, a single registered buffer is read into without mapping its pages every time
+        if (const auto buffer {m_receive_buffer.registered_free_space()}) {
+            m_tcp_socket.async_read_some(*buffer, std::move(handler));
+        } else {
+            m_tcp_socket.async_read_some(m_receive_buffer.free_space(), std::move(handler));
+        }
     }
 
     void ServerConnection::task_read_payload() {
-        asio::async_read(m_tcp_socket, asio::buffer(m_current_incoming_message.payload.get(), m_current_incoming_message.header.payload_size),
-            [this](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
+        const std::size_t size {m_current_incoming_message.header.payload_size - m_payload_received};
+
+        asio::async_read(m_tcp_socket, asio::buffer(m_current_incoming_message.payload.data() + m_payload_received, size),
+            [this, size](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
                 if (ec) {
-                    m_tcp_socket.close();
+                    close_socket();
 
                     throw ConnectionError("Could not read payload: " + ec.message());
                 }
 
-                assert(bytes_transferred == m_current_incoming_message.header.payload_size);
+                assert(bytes_transferred == size);
 
                 add_to_incoming_messages();
-                task_read_header();
+                read_messages();
             }
         );
     }
 
-    void ServerConnection::task_send_message(const Message& message) {
-        asio::post(m_asio_context,
-            [this, message]() {
-                const bool writing_tasks_stopped {m_outgoing_messages.empty()};
+    void ServerConnection::task_send_message(SharedMessage message, const SendOptions& options) {
+        // Allocate the task from the pool as well
+        asio::post(m_asio_context, asio::bind_allocator(internal::PoolAllocator<void>(),
+            [this, message = std::move(message), options]() mutable {
+                const bool writing_tasks_stopped {m_writing_messages.empty()};
 
-                m_outgoing_messages.push_back(internal::clone_message(message));
+                // Only the reference is copied, not the payload
+                queue_outgoing(std::move(message), options);
 
                 // Restart the writing process, if it has stopped before
                 if (writing_tasks_stopped) {
                     task_write_message();
                 }
             }
-        );
+        ));
     }
 
     void ServerConnection::task_connect_to_server() {
         asio::async_connect(m_tcp_socket, m_endpoints,
             [this](asio::error_code ec, asio::ip::tcp::endpoint) {
                 if (ec) {
-                    m_tcp_socket.close();
+                    close_socket();
 
                     throw ConnectionError("Could not connect to server: " + ec.message());
                 }
 
-                task_read_header();
+                m_open.store(true, std::memory_order_release);
+
+                // Say hello first, unless messages sent in the meantime have taken it along
+                if (!m_hello_sent) {
+                    task_write_message();
+                }
+
+                read_messages();
 
                 m_established_connection.store(true);
+                m_notifier.notify();
             }
         );
     }
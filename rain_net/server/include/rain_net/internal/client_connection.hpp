@@ -5,43 +5,95 @@
 #include <cstdint>
 #include <functional>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "rain_net/internal/connection.hpp"
 
 namespace rain_net {
     class Server;
 
+    // A light reference to a client, that doesn't keep its connection alive
+    // It's plain data, so passing it around costs no reference counting
+    // Client IDs are reused after disconnecting, so the generation tells if a handle has become stale
+    struct ConnectionHandle {
+        std::uint32_t id {};
+        std::uint32_t generation {};  // Zero never refers to a client
+
+        bool operator==(const ConnectionHandle& other) const noexcept {
+            return id == other.id && generation == other.generation;
+        }
+
+        bool operator!=(const ConnectionHandle& other) const noexcept {
+            return !(*this == other);
+        }
+    };
+
+    static_assert(std::is_trivially_copyable_v<ConnectionHandle>);
+
     // Owner of this is the server
     class ClientConnection final : public internal::Connection, public std::enable_shared_from_this<ClientConnection> {
     public:
         ClientConnection(
             asio::io_context& asio_context,
             asio::ip::tcp::socket&& tcp_socket,
-            internal::SyncQueue<std::pair<Message, std::shared_ptr<ClientConnection>>>& incoming_messages,
+            internal::SpscQueue<std::pair<Message, ConnectionHandle>>& incoming_messages,
+            internal::Notifier& notifier,
             std::uint32_t client_id,
-            const std::function<void(const std::string&)>& log
+            std::uint32_t generation,
+            const std::function<void(const std::string&)>& log,
+            const std::function<void(Message, std::shared_ptr<ClientConnection>)>& on_message,
+            const ConnectionOptions& options,
+            internal::ReceiveSlab* receive_slab = nullptr
         )
-            : internal::Connection(asio_context, std::move(tcp_socket)), m_incoming_messages(incoming_messages),
-            m_log(log), m_client_id(client_id) {}
+            : internal::Connection(asio_context, std::move(tcp_socket), options, receive_slab), m_incoming_messages(incoming_messages),
+            m_notifier(notifier), m_log(log), m_on_message(on_message), m_client_id(client_id),
+            m_generation(generation) {}
 
         // Send a message asynchronously
-        void send(const Message& message);
+        // Returns false, if the message has not been queued, because of the slow consumer policy
+        bool send(const Message& message, const SendOptions& options = {});
+
+        // Send a shared message asynchronously; the payload is not copied
+        // Returns false, if the message has not been queued, because of the slow consumer policy
+        bool send(const SharedMessage& message, const SendOptions& options = {});
+
+        // Get how many times the slow consumer policy has been applied
+        SlowConsumerStatistics slow_consumer_statistics() const noexcept;
 
         // Get the unique ID of this client
         std::uint32_t get_id() const noexcept;
+
+        // Get the handle referring to this client
+        ConnectionHandle handle() const noexcept;
     private:
         void start_communication();
         void add_to_incoming_messages();
+        void read_messages();
 
         void task_write_message();
-        void task_read_header();
+        void task_write_buffers();
+        void task_read();
         void task_read_payload();
-        void task_send_message(const Message& message);
+        void task_send_message(SharedMessage message, const SendOptions& options);
+
+        // Must be called in the network thread
+        void queue_message(SharedMessage message, const SendOptions& options);
+
+        // Like send(), but the pending message doesn't keep the connection alive, sparing the reference counting
+        // Only for the server, which keeps its connections alive until their event loop has run the pending work
+        bool send_unowned(const Message& message, const SendOptions& options);
+        bool send_unowned(const SharedMessage& message, const SendOptions& options);
+        void task_send_message_unowned(SharedMessage message, const SendOptions& options);
 
-        internal::SyncQueue<std::pair<Message, std::shared_ptr<ClientConnection>>>& m_incoming_messages;
+        internal::SpscQueue<std::pair<Message, ConnectionHandle>>& m_incoming_messages;
+        internal::Notifier& m_notifier;
         const std::function<void(const std::string&)>& m_log;
+        const std::function<void(Message, std::shared_ptr<ClientConnection>)>& m_on_message;  // Bypasses the queue, if set
         std::uint32_t m_client_id {};  // Given by the server
+        std::uint32_t m_generation {};  // Given by the server
         bool m_used {false};  // Set to true after using the connection and calling on_client_disconnected()
+        std::vector<std::uint32_t> m_groups;  // The groups this client is in; used by the server
 
         friend class Server;
     };
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <limits>
+
+#include "rain_net/internal/client_connection.hpp"
+
+namespace rain_net {
+    namespace internal {
+        // The connections of the server, indexed by their IDs
+        // They are kept contiguous for iterating, while a second table maps the IDs to their positions
+        // Lookup, insertion and removal are constant time; removal moves the last connection into the gap
+        class ConnectionTable final {
+        public:
+            ConnectionTable() noexcept = default;
+            ~ConnectionTable() = default;
+
+            ConnectionTable(const ConnectionTable&) = delete;
+            ConnectionTable& operator=(const ConnectionTable&) = delete;
+            ConnectionTable(ConnectionTable&&) = delete;
+            ConnectionTable& operator=(ConnectionTable&&) = delete;
+
+            // Make room for IDs in the range [0, size); removes all connections
+            void create(std::uint32_t size);
+
+            // The ID of the connection must not be in the table
+            void insert(std::shared_ptr<ClientConnection> connection);
+
+            // The ID must be in the table
+            void erase(std::uint32_t id) noexcept;
+
+            // Returns null, if the ID is not in the table
+            std::shared_ptr<ClientConnection> find(std::uint32_t id) const;
+
+            // Returns null, if the handle is stale; doesn't touch the reference count
+            ClientConnection* get(ConnectionHandle handle) const noexcept;
+
+            // Returns null, if the ID is not in the table; doesn't touch the reference count
+            ClientConnection* get(std::uint32_t id) const noexcept;
+
+            void clear() noexcept;
+
+            std::size_t size() const noexcept { return m_connections.size(); }
+
+            // Positions change on removal
+            const std::shared_ptr<ClientConnection>& operator[](std::size_t index) const noexcept { return m_connections[index]; }
+
+            auto begin() const noexcept { return m_connections.cbegin(); }
+            auto end() const noexcept { return m_connections.cend(); }
+        private:
+            static constexpr std::uint32_t NONE {std::numeric_limits<std::uint32_t>::max()};
+
+            std::vector<std::shared_ptr<ClientConnection>> m_connections;
+            std::vector<std::uint32_t> m_indices;  // Position of every ID in m_connections, or NONE
+        };
+    }
+}
@@ -3,10 +3,13 @@
 #include <cstdint>
 #include <optional>
 #include <memory>
-#include <mutex>
+#include <atomic>
 
 namespace rain_net {
     namespace internal {
+        // Allocator of IDs in the range [0, size), keeping one bit per ID
+        // A second level of bits marks the full words, so that allocating skips 64 words at once
+        // Allocating and deallocating are lock-free and may be called from any thread, but not concurrently with create()
         class Pool final {
         public:
             Pool() noexcept = default;
@@ -18,16 +21,19 @@ namespace rain_net {
             Pool& operator=(Pool&& other) = delete;
 
             void create(std::uint32_t size);
-            std::optional<std::uint32_t> allocate_id();
-            void deallocate_id(std::uint32_t id);
+            std::optional<std::uint32_t> allocate_id() noexcept;
+            void deallocate_id(std::uint32_t id) noexcept;
         private:
-            std::optional<std::uint32_t> search_and_allocate_id(std::uint32_t begin, std::uint32_t end) noexcept;
+            std::optional<std::uint32_t> search_and_allocate_id(std::uint32_t begin) noexcept;
+            std::optional<std::uint32_t> allocate_in_word(std::uint32_t word_index, std::uint64_t skip) noexcept;
+            void mark_full(std::uint32_t word_index) noexcept;
 
-            std::unique_ptr<bool[]> m_pool;  // False means it's not allocated
+            std::unique_ptr<std::atomic<std::uint64_t>[]> m_words;  // Set bits mean allocated
+            std::unique_ptr<std::atomic<std::uint64_t>[]> m_full_words;  // Set bits mean the word is full
             std::uint32_t m_size {};
-            std::uint32_t m_id_pointer {};
-
-            std::mutex m_mutex;
+            std::uint32_t m_word_count {};
+            std::uint32_t m_full_word_count {};
+            std::atomic<std::uint32_t> m_id_pointer {};  // Only a hint of where to start searching
         };
     }
 }
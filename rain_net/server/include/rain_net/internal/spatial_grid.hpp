@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <limits>
+
+namespace rain_net {
+    // Position of a client in the world, as tracked by the server
+    struct Position {
+        float x {};
+        float y {};
+    };
+
+    namespace internal {
+        // Positions of the clients, indexed by their IDs, bucketed in a uniform grid of square cells
+        // A query only looks at the cells overlapping the circle, so its cost depends on
+        // how many clients are nearby, not on how many there are in total
+        class SpatialGrid final {
+        public:
+            SpatialGrid() = default;
+            ~SpatialGrid() = default;
+
+            SpatialGrid(const SpatialGrid&) = delete;
+            SpatialGrid& operator=(const SpatialGrid&) = delete;
+            SpatialGrid(SpatialGrid&&) = delete;
+            SpatialGrid& operator=(SpatialGrid&&) = delete;
+
+            // Set the size of the cells; removes all positions
+            void create(float cell_size);
+
+            // Insert or move a client
+            void set_position(std::uint32_t id, Position position);
+
+            // Does nothing, if the client has no position
+            void remove(std::uint32_t id) noexcept;
+
+            // Remove all positions
+            void clear() noexcept;
+
+            // Call the function with the ID of every client within the radius (inclusive)
+            // The grid must not be changed meanwhile
+            template<typename Function>
+            void query(Position center, float radius, Function function) const {
+                if (!(radius >= 0.0f)) {
+                    return;
+                }
+
+                const float radius_squared {radius * radius};
+
+                const auto visit_cell {[&](const std::vector<std::uint32_t>& ids) {
+                    for (const std::uint32_t id : ids) {
+                        const Position& position {m_entries[id].position};
+                        const float dx {position.x - center.x};
+                        const float dy {position.y - center.y};
+
+                        if (dx * dx + dy * dy <= radius_squared) {
+                            function(id);
+                        }
+                    }
+                }};
+
+                const std::int64_t begin_x {cell_coordinate(center.x - radius)};
+                const std::int64_t end_x {cell_coordinate(center.x + radius)};
+                const std::int64_t begin_y {cell_coordinate(center.y - radius)};
+                const std::int64_t end_y {cell_coordinate(center.y + radius)};
+
+                // Huge radii cover more cells than there are occupied ones
+                if ((end_x - begin_x + 1) * (end_y - begin_y + 1) > static_cast<std::int64_t>(m_cells.size())) {
+                    for (const auto& [key, ids] : m_cells) {
+                        visit_cell(ids);
+                    }
+
+                    return;
+                }
+
+                for (std::int64_t y {begin_y}; y <= end_y; y++) {
+                    for (std::int64_t x {begin_x}; x <= end_x; x++) {
+                        const auto iter {m_cells.find(cell_key(x, y))};
+
+                        if (iter != m_cells.end()) {
+                            visit_cell(iter->second);
+                        }
+                    }
+                }
+            }
+        private:
+            static constexpr std::uint32_t NONE {std::numeric_limits<std::uint32_t>::max()};
+
+            struct Entry {
+                Position position;
+                std::uint64_t cell {};
+                std::uint32_t index {NONE};  // Position in its cell, or NONE
+            };
+
+            std::int64_t cell_coordinate(float value) const noexcept;
+            static std::uint64_t cell_key(std::int64_t x, std::int64_t y) noexcept;
+            void remove_from_cell(std::uint32_t id) noexcept;
+
+            float m_cell_size {1.0f};
+            std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> m_cells;  // Only the occupied ones
+            std::vector<Entry> m_entries;  // Grows with the largest ID seen
+        };
+    }
+}
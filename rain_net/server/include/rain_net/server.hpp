@@ -3,12 +3,18 @@
 #include <cstdint>
 #include <memory>
 #include <thread>
-#include <forward_list>
+#include <vector>
+#include <cstddef>
 #include <limits>
 #include <string>
 #include <utility>
 #include <functional>
 #include <exception>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic push
@@ -17,23 +23,59 @@
 
 #include <asio/io_context.hpp>
 #include <asio/ip/tcp.hpp>
+#include <asio/executor_work_guard.hpp>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic pop
 #endif
 
 #include "rain_net/internal/queue.hpp"
+#include "rain_net/internal/spsc_queue.hpp"
+#include "rain_net/internal/notifier.hpp"
+#include "rain_net/internal/receive_slab.hpp"
 #include "rain_net/internal/message.hpp"
 #include "rain_net/internal/client_connection.hpp"
+#include "rain_net/internal/connection_table.hpp"
 #include "rain_net/internal/pool.hpp"
+#include "rain_net/internal/spatial_grid.hpp"
 
 // Forward
 #include "rain_net/internal/error.hpp"
 
 namespace rain_net {
+    // Options for tuning the server
+    struct ServerOptions {
+        // Maximum amount of clients allowed; the IDs of the clients are in the range [0, max_clients)
+        // It may go well beyond the default, as for big lobby servers; the ID tables grow with it
+        std::uint32_t max_clients {std::numeric_limits<std::uint16_t>::max()};
+
+        // Amount of threads doing the network work; each one has its own event loop
+        // New connections are assigned to them in a round-robin fashion
+        std::size_t io_threads {1};
+
+        // Open a listener for each io thread with SO_REUSEPORT, letting the kernel balance new connections among them
+        // Otherwise, the first io thread accepts all of them
+        // Ignored on platforms without SO_REUSEPORT
+        bool reuse_port {false};
+
+        // Receive buffers registered with each io thread's event loop; connections beyond that get ordinary buffers
+        // Only io_uring makes use of them; they are locked in memory, so mind RLIMIT_MEMLOCK
+        std::size_t registered_receive_buffers {internal::IO_URING ? 256 : 0};
+
+        // Size of the square cells in which client positions are bucketed for send_message_in_radius()
+        // Works best around the usual radius; must be positive
+        float interest_cell_size {64.0f};
+
+        // Options for every connection
+        ConnectionOptions connection;
+    };
+
     // Base class for the server program
     class Server final {
     public:
+        // Identifier of a group of clients
+        using GroupId = std::uint32_t;
+
         // Default capacity of clients
         static constexpr std::uint32_t MAX_CLIENTS {std::numeric_limits<std::uint16_t>::max()};
 
@@ -45,7 +87,7 @@ namespace rain_net {
             std::function<void(Server&, std::shared_ptr<ClientConnection>)> on_client_disconnected,
             std::function<void(const std::string&)> on_log = ON_LOG
         )
-            : m_acceptor(m_asio_context), m_on_client_connected(std::move(on_client_connected)),
+            : m_on_client_connected(std::move(on_client_connected)),
             m_on_client_disconnected(std::move(on_client_disconnected)), m_on_log(std::move(on_log)) {}
 
         ~Server();
@@ -58,10 +100,29 @@ namespace rain_net {
         // Start the internal event loop and start accepting connection requests
         // You may call this only once in the beginning or after calling stop()
         // Specify the port number on which to listen and the maximum amount of clients allowed
+        // Optionally specify options for tuning the connections
+        // Throws connection errors
+        void start(std::uint16_t port, std::uint32_t max_clients = MAX_CLIENTS, const ConnectionOptions& options = {});
+
+        // Start the internal event loops and start accepting connection requests
+        // You may call this only once in the beginning or after calling stop()
+        // Specify the port number on which to listen and the options of the server
+        // With multiple io threads, on_log() is called from all of them
         // Throws connection errors
-        void start(std::uint16_t port, std::uint32_t max_clients = MAX_CLIENTS);
+        void start(std::uint16_t port, const ServerOptions& options);
+
+        // Handle incoming messages right in the io threads, instead of queueing them for next_message()
+        // This skips the hop to the main thread, for services where that latency matters
+        // You may call this only before start(); pass an empty function to go back to the queue
+        // Threading rules for the callback:
+        //   It runs in an io thread; with multiple io threads, it runs concurrently for different connections,
+        //   but the messages of one connection come in order, one at a time
+        //   It must be quick, as the connections of its io thread wait for it
+        //   It may reply with connection->send(), but it must not call any Server method
+        //   It must not throw
+        void set_on_message(std::function<void(Message, std::shared_ptr<ClientConnection>)> on_message);
 
-        // Disconnect from all the clients and stop the internal event loop
+        // Disconnect from all the clients, destroy all the groups and stop the internal event loops
         // You may call this at any time
         // After a call to stop(), you may restart by calling start() again
         // It is automatically called in the destructor
@@ -72,51 +133,182 @@ namespace rain_net {
         // Throws connection errors
         void accept_connections();
 
-        // Poll the next incoming message from the queue
+        // Poll the next incoming message from the queue, along with the handle of its sender
         // You may call it in a loop to process as many messages as you want
-        std::pair<Message, std::shared_ptr<ClientConnection>> next_message();
+        // There must be an available message; check with available_messages() first
+        // Takes turns among the io threads, so every one of them gets its share
+        std::pair<Message, ConnectionHandle> next_message();
 
         // Check if there are available incoming messages
         bool available_messages() const;
 
+        // Block until there are incoming messages or new connections to accept, or until the timeout expires
+        // Optionally spin for a while before sleeping, which reacts faster, but burns CPU
+        // Returns early also when an error occurred; the next call that throws errors will throw it
+        // Returns true, if there is something to process
+        bool wait_for_messages(std::chrono::nanoseconds timeout, std::chrono::nanoseconds spin = {});
+
+        // Get a handle that becomes readable when there are incoming messages or new connections to accept
+        // Use it to integrate the server into another event loop, like epoll (it's an eventfd on Linux)
+        // It stays readable until accept_connections() and draining the incoming messages leave nothing to process
+        // Don't read from it and don't close it
+        // Returns -1, if it's not supported on this platform
+        int event_handle();
+
+        // Take all the available incoming messages at once, but at most max, appending them to the vector
+        // Returns the amount of messages taken
+        std::size_t drain_messages(
+            std::vector<std::pair<Message, ConnectionHandle>>& messages,
+            std::size_t max = std::numeric_limits<std::size_t>::max()
+        );
+
         // Check all connections to see if they are valid; invokes on_client_disconnected() when needed
         // You may not really need it
         // Throws connection errors
         void check_connections();
 
+        // Get the accepted client with this ID, in constant time
+        // Returns null, if there is no such client, or if it has been reported as disconnected
+        std::shared_ptr<ClientConnection> connection(std::uint32_t id) const;
+
+        // Get the client referred to by the handle, in constant time
+        // This copies a shared_ptr; for sending, pass the handle itself, which doesn't
+        // Returns null, if the handle is stale, or if the client has been reported as disconnected
+        std::shared_ptr<ClientConnection> connection(ConnectionHandle handle) const;
+
         // Send a message to a specific client; invokes on_client_disconnected() when needed
+        // Optionally specify the priority and other options for sending
+        // Returns false, if the message has not been queued, because the client is not keeping up
+        // (see ConnectionOptions::slow_consumer_policy) or because it has disconnected
         // Throws connection errors
-        void send_message(std::shared_ptr<ClientConnection> connection, const Message& message);
+        bool send_message(std::shared_ptr<ClientConnection> connection, const Message& message, const SendOptions& options = {});
+
+        // Send a shared message to a specific client; the payload is not copied
+        // Invokes on_client_disconnected() when needed
+        // Returns false, if the message has not been queued
+        // Throws connection errors
+        bool send_message(std::shared_ptr<ClientConnection> connection, const SharedMessage& message, const SendOptions& options = {});
+
+        // Send a message to the client referred to by the handle; invokes on_client_disconnected() when needed
+        // Unlike the shared_ptr overloads, this doesn't touch any reference count
+        // Returns false, if the message has not been queued, or if the handle is stale
+        // Throws connection errors
+        bool send_message(ConnectionHandle connection, const Message& message, const SendOptions& options = {});
+        bool send_message(ConnectionHandle connection, const SharedMessage& message, const SendOptions& options = {});
 
         // Send a message to all clients; invokes on_client_disconnected() when needed
+        // The message is copied only once and shared among all the clients
+        // The slow consumer policy applies to each client separately
         // Throws connection errors
-        void send_message_broadcast(const Message& message);
+        void send_message_broadcast(const Message& message, const SendOptions& options = {});
+        void send_message_broadcast(const SharedMessage& message, const SendOptions& options = {});
 
         // Send a message to all clients except a specific client; invokes on_client_disconnected() when needed
+        // The message is copied only once and shared among all the clients
         // Throws connection errors
-        void send_message_broadcast(const Message& message, std::shared_ptr<ClientConnection> exception);
+        void send_message_broadcast(const Message& message, std::shared_ptr<ClientConnection> exception, const SendOptions& options = {});
+        void send_message_broadcast(const SharedMessage& message, std::shared_ptr<ClientConnection> exception, const SendOptions& options = {});
+        void send_message_broadcast(const Message& message, ConnectionHandle exception, const SendOptions& options = {});
+        void send_message_broadcast(const SharedMessage& message, ConnectionHandle exception, const SendOptions& options = {});
+
+        // Create an empty group of clients, like a room or a match
+        // Groups may be created before start(); they are kept until destroyed, or until stop() is called
+        GroupId create_group();
+
+        // Destroy a group; its clients are not affected
+        void destroy_group(GroupId group);
+
+        // Add a client to a group; clients leave all their groups when they disconnect
+        // Returns false, if the group doesn't exist, if the handle is stale or if the client is already in the group
+        bool join_group(GroupId group, ConnectionHandle connection);
+
+        // Remove a client from a group
+        // Returns false, if the group doesn't exist, if the handle is stale or if the client is not in the group
+        bool leave_group(GroupId group, ConnectionHandle connection);
+
+        // Get the amount of clients in a group; the group must exist
+        std::size_t group_size(GroupId group) const;
+
+        // Send a message to all the clients in a group; the group must exist
+        // The message is copied only once and then queued to every client by its io thread,
+        // without going through the rest of the clients
+        // The slow consumer policy applies to each client separately
+        // Throws connection errors
+        void send_message_group(GroupId group, const Message& message, const SendOptions& options = {});
+        void send_message_group(GroupId group, const SharedMessage& message, const SendOptions& options = {});
+
+        // Set or update the position of a client, for send_message_in_radius()
+        // Clients have no position until it is set, and lose it when they disconnect
+        // Returns false, if the handle is stale
+        bool set_position(ConnectionHandle connection, Position position);
+
+        // Remove the position of a client, so that it's not reached by send_message_in_radius() anymore
+        // Returns false, if the handle is stale
+        bool clear_position(ConnectionHandle connection);
+
+        // Send a message to all the clients whose position is within the radius of a point
+        // Only the clients in the nearby cells of the grid are looked at
+        // The message is copied only once and shared among all the clients
+        // Throws connection errors
+        void send_message_in_radius(Position position, float radius, const Message& message, const SendOptions& options = {});
+        void send_message_in_radius(Position position, float radius, const SharedMessage& message, const SendOptions& options = {});
     private:
-        using ConnectionsIter = std::forward_list<std::shared_ptr<ClientConnection>>::iterator;
+        // An event loop with its own thread, serving a part of the connections
+        struct IoThread {
+            asio::io_context context;
+            std::optional<internal::ReceiveSlab> receive_slab;  // Registered only once, as long as the event loop lives
+            std::optional<asio::executor_work_guard<asio::io_context::executor_type>> work;  // Keeps it running without connections
+            asio::ip::tcp::acceptor acceptor {context};
+            internal::SpscQueue<std::pair<Message, ConnectionHandle>> incoming_messages;
+            std::thread thread;
+        };
+
+        // Members are split by io thread, so that each io thread queues the message to its own clients
+        // The member lists are replaced, not changed, as the io threads may still be reading the old ones
+        using GroupMembers = std::vector<std::shared_ptr<ClientConnection>>;
+
+        struct Group {
+            std::vector<std::shared_ptr<const GroupMembers>> members;  // One list per io thread
+            std::size_t size {};
+        };
+
+        bool has_incoming_messages() const;
+        IoThread& next_io_thread();
+        std::size_t io_thread_index(const ClientConnection& connection) const;
+        void remove_from_group(Group& group, const ClientConnection& connection);
 
         void throw_if_error();
-        void task_accept_connection();
+        void set_error(std::exception_ptr error);
+        void reset_event();
+        void open_acceptor(asio::ip::tcp::acceptor& acceptor, const asio::ip::tcp::endpoint& endpoint, bool reuse_port);
+        void task_accept_connection(IoThread& acceptor_thread);
         void maybe_client_disconnected(std::shared_ptr<ClientConnection> connection);
-        bool maybe_client_disconnected(std::shared_ptr<ClientConnection> connection, ConnectionsIter& iter, ConnectionsIter before_iter);
 
-        std::forward_list<std::shared_ptr<ClientConnection>> m_connections;
+        internal::ConnectionTable m_connections;
+        std::unordered_map<GroupId, Group> m_groups;
+        GroupId m_next_group {};
+        internal::SpatialGrid m_grid;
         internal::SyncQueue<std::shared_ptr<ClientConnection>> m_new_connections;
-        internal::SyncQueue<std::pair<Message, std::shared_ptr<ClientConnection>>> m_incoming_messages;
+        internal::Notifier m_notifier;
 
-        std::thread m_context_thread;
-        asio::io_context m_asio_context;
-        asio::ip::tcp::acceptor m_acceptor;
+        // The first one is also accepting connections, unless every one of them is
+        std::vector<std::unique_ptr<IoThread>> m_io_threads;
+        std::vector<std::unique_ptr<IoThread>> m_spare_io_threads;  // From runs with more io threads
+        bool m_sharded_acceptors {false};
+        std::size_t m_next_io_thread {};  // Used by the accepting thread
+        std::size_t m_next_incoming_messages {};  // Used by the main thread
+        std::atomic<std::uint32_t> m_next_generation {1};  // Used by the accepting threads
 
         std::function<bool(Server&, std::shared_ptr<ClientConnection>)> m_on_client_connected;
         std::function<void(Server&, std::shared_ptr<ClientConnection>)> m_on_client_disconnected;
         std::function<void(const std::string&)> m_on_log;
+        std::function<void(Message, std::shared_ptr<ClientConnection>)> m_on_message;
 
         internal::Pool m_pool;
+        ConnectionOptions m_connection_options;
+        std::mutex m_error_mutex;
         std::exception_ptr m_error;
-        bool m_running {false};
+        std::atomic_bool m_error_occurred {false};  // Set after m_error, as m_error is written by the event loop threads
+        std::atomic_bool m_running {false};
     };
 }
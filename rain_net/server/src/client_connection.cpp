@@ -10,8 +10,8 @@
 
 #include <asio/buffer.hpp>
 #include <asio/read.hpp>
-#include <asio/write.hpp>
 #include <asio/post.hpp>
+#include <asio/bind_allocator.hpp>
 #include <asio/connect.hpp>
 #include <asio/error_code.hpp>
 
@@ -20,119 +20,238 @@
 #endif
 
 #include "rain_net/internal/error.hpp"
+#include "rain_net/internal/buffer_pool.hpp"
 #include "rain_net/conversion.hpp"  // TODO
 
 namespace rain_net {
-    void ClientConnection::send(const Message& message) {
-        task_send_message(message);
+    bool ClientConnection::send(const Message& message, const SendOptions& options) {
+        // Don't copy the message, if it's not going to be queued
+        if (!admit_outgoing(message.size(), options)) {
+            return false;
+        }
+
+        task_send_message(SharedMessage(message), options);
+
+        return true;
+    }
+
+    bool ClientConnection::send(const SharedMessage& message, const SendOptions& options) {
+        if (!admit_outgoing(message.size(), options)) {
+            return false;
+        }
+
+        task_send_message(message, options);
+
+        return true;
+    }
+
+    SlowConsumerStatistics ClientConnection::slow_consumer_statistics() const noexcept {
+        return get_slow_consumer_statistics();
     }
 
     std::uint32_t ClientConnection::get_id() const noexcept {
         return m_client_id;
     }
 
+    ConnectionHandle ClientConnection::handle() const noexcept {
+        return ConnectionHandle {m_client_id, m_generation};
+    }
+
     void ClientConnection::start_communication() {
-        task_read_header();
+        // The socket must only be used in its network thread
+        asio::post(m_asio_context, [this, self = shared_from_this()]() {
+            // Say hello first, unless messages sent in the meantime have taken it along
+            if (!m_hello_sent) {
+                task_write_message();
+            }
+
+            read_messages();
+        });
     }
 
     void ClientConnection::add_to_incoming_messages() {
-        m_incoming_messages.push_back(std::make_pair(
-            Message(m_current_incoming_message.header, std::move(m_current_incoming_message.payload)),
-            shared_from_this()
-        ));
+        Message message {std::move(m_current_incoming_message)};
 
         m_current_incoming_message = {};
+
+        // Hand it over right here in the network thread
+        if (m_on_message) {
+            m_on_message(std::move(message), shared_from_this());
+            return;
+        }
+
+        m_incoming_messages.push_back(std::make_pair(std::move(message), handle()));
+
+        m_notifier.notify();
     }
 
     void ClientConnection::task_write_message() {
-        assert(!m_outgoing_messages.empty());
+        assert(has_outgoing_messages() || !m_hello_sent);
 
-        std::vector<asio::const_buffer> buffers;
-        buffers.emplace_back(&m_outgoing_messages.front().header, sizeof(internal::MsgHeader));
+        // Write as many queued messages as possible at once
+        if (!gather_messages()) {
+            close_socket();
 
-        if (m_outgoing_messages.front().header.payload_size > 0) {
-            buffers.emplace_back(m_outgoing_messages.front().payload.get(), m_outgoing_messages.front().header.payload_size);
+            m_log('[' + std::to_string(get_id()) + "] Message too large for the peer, which doesn't support the extended header");
+            return;
         }
 
-        const std::size_t size {internal::buffers_size(buffers)};
+        // Everything may have expired
+        if (m_writing_messages.empty()) {
+            return;
+        }
+
+        task_write_buffers();
+    }
 
-        asio::async_write(m_tcp_socket, buffers,
-            [this, size](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
+    void ClientConnection::task_write_buffers() {
+        m_tcp_socket.async_write_some(m_write_buffers,
+            [this, self = shared_from_this()](asio::error_code ec, std::size_t bytes_transferred) {
                 if (ec) {
-                    m_tcp_socket.close();
+                    close_socket();
 
-                    m_log('[' + std::to_string(get_id()) + "] Could not write message: " + ec.message());
+                    m_log('[' + std::to_string(get_id()) + "] Could not write messages: " + ec.message());
                     return;
                 }
 
-                assert(bytes_transferred == size);
+                m_write_buffers.consume(bytes_transferred);
+
+                // Continue, if not everything has been written
+                if (m_write_buffers.count() > 0) {
+                    task_write_buffers();
+                    return;
+                }
 
-                m_outgoing_messages.pop_front();
+                finish_writing();
 
                 // Thus writing tasks can stop
-                if (!m_outgoing_messages.empty()) {
+                if (has_outgoing_messages()) {
                     task_write_message();
                 }
             }
         );
     }
 
-    void ClientConnection::task_read_header() {
-        asio::async_read(m_tcp_socket, asio::buffer(&m_current_incoming_message.header, sizeof(internal::MsgHeader)),
-            [this](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
-                if (ec) {
-                    m_tcp_socket.close();
+    void ClientConnection::read_messages() {
+        // Handle every message that has been received so far
+        while (true) {
+            const Received received {receive_message()};
+
+            // The first message of the peer tells if it can take the messages that have been held back
+            if (resume_held_back()) {
+                task_write_message();
+            }
 
-                    m_log('[' + std::to_string(get_id()) + "] Could not read header: " + ec.message());
+            switch (received) {
+                case Received::Message:
+                    add_to_incoming_messages();
+                    break;
+                case Received::NeedData:
+                    task_read();
                     return;
-                }
+                case Received::LargePayload:
+                    task_read_payload();
+                    return;
+                case Received::Hello:
+                    break;
+                case Received::TooLarge:
+                    close_socket();
 
-                assert(bytes_transferred == sizeof(internal::MsgHeader));
+                    m_log('[' + std::to_string(get_id()) + "] Message too large: " + std::to_string(m_current_incoming_message.header.payload_size));
+                    return;
+            }
+        }
+    }
 
-                // Check if there is a payload to read
-                if (m_current_incoming_message.header.payload_size > 0) {
-                    // Allocate space so that we write to it later
-                    m_current_incoming_message.payload = std::make_unique<unsigned char[]>(m_current_incoming_message.header.payload_size);
+    void ClientConnection::task_read() {
+        auto handler {[this, self = shared_from_this()](asio::error_code ec, std::size_t bytes_transferred) {
+            if (ec) {
+                close_socket();
 
-                    task_read_payload();
-                } else {
-                    add_to_incoming_messages();
-                    task_read_header();
-                }
+                m_log('[' + std::to_string(get_id()) + "] Could not read: " + ec.message());
+                return;
             }
-        );
+
+            m_receive_buffer.produce(bytes_transferred);
+
+            read_messages();
+        }};
+
+        // With io_uring, a single registered buffer is read into without mapping its pages every time
+        if (const auto buffer {m_receive_buffer.registered_free_space()}) {
+            m_tcp_socket.async_read_some(*buffer, std::move(handler));
+        } else {
+            m_tcp_socket.async_read_some(m_receive_buffer.free_space(), std::move(handler));
+        }
     }
 
     void ClientConnection::task_read_payload() {
-        asio::async_read(m_tcp_socket, asio::buffer(m_current_incoming_message.payload.get(), m_current_incoming_message.header.payload_size),
-            [this](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
+        const std::size_t size {m_current_incoming_message.header.payload_size - m_payload_received};
+
+        asio::async_read(m_tcp_socket, asio::buffer(m_current_incoming_message.payload.data() + m_payload_received, size),
+            [this, self = shared_from_this(), size](asio::error_code ec, [[maybe_unused]] std::size_t bytes_transferred) {
                 if (ec) {
-                    m_tcp_socket.close();
+                    close_socket();
 
                     m_log('[' + std::to_string(get_id()) + "] Could not read payload: " + ec.message());
                     return;
                 }
 
-                assert(bytes_transferred == m_current_incoming_message.header.payload_size);
+                assert(bytes_transferred == size);
 
                 add_to_incoming_messages();
-                task_read_header();
+                read_messages();
             }
         );
     }
 
-    void ClientConnection::task_send_message(const Message& message) {
-        asio::post(m_asio_context,
-            [this, message]() {
-                const bool writing_tasks_stopped {m_outgoing_messages.empty()};
+    void ClientConnection::task_send_message(SharedMessage message, const SendOptions& options) {
+        // Allocate the task from the pool as well
+        // Keep the connection alive, as the server may let go of it in the meantime
+        asio::post(m_asio_context, asio::bind_allocator(internal::PoolAllocator<void>(),
+            [this, self = shared_from_this(), message = std::move(message), options]() mutable {
+                queue_message(std::move(message), options);
+            }
+        ));
+    }
+
+    bool ClientConnection::send_unowned(const Message& message, const SendOptions& options) {
+        if (!admit_outgoing(message.size(), options)) {
+            return false;
+        }
 
-                m_outgoing_messages.push_back(internal::clone_message(message));
+        task_send_message_unowned(SharedMessage(message), options);
 
-                // Restart the writing process, if it has stopped before
-                if (writing_tasks_stopped) {
-                    task_write_message();
-                }
+        return true;
+    }
+
+    bool ClientConnection::send_unowned(const SharedMessage& message, const SendOptions& options) {
+        if (!admit_outgoing(message.size(), options)) {
+            return false;
+        }
+
+        task_send_message_unowned(message, options);
+
+        return true;
+    }
+
+    void ClientConnection::task_send_message_unowned(SharedMessage message, const SendOptions& options) {
+        asio::post(m_asio_context, asio::bind_allocator(internal::PoolAllocator<void>(),
+            [this, message = std::move(message), options]() mutable {
+                queue_message(std::move(message), options);
             }
-        );
+        ));
+    }
+
+    void ClientConnection::queue_message(SharedMessage message, const SendOptions& options) {
+        const bool writing_tasks_stopped {m_writing_messages.empty()};
+
+        // Only the reference is copied, not the payload
+        queue_outgoing(std::move(message), options);
+
+        // Restart the writing process, if it has stopped before
+        if (writing_tasks_stopped) {
+            task_write_message();
+        }
     }
 }
@@ -0,0 +1,77 @@
+#include "rain_net/internal/connection_table.hpp"
+
+#include <cassert>
+#include <utility>
+
+namespace rain_net {
+    namespace internal {
+        void ConnectionTable::create(std::uint32_t size) {
+            m_connections.clear();
+            m_indices.assign(size, NONE);
+        }
+
+        void ConnectionTable::insert(std::shared_ptr<ClientConnection> connection) {
+            const std::uint32_t id {connection->get_id()};
+
+            assert(id < m_indices.size());
+            assert(m_indices[id] == NONE);
+
+            m_indices[id] = static_cast<std::uint32_t>(m_connections.size());
+            m_connections.push_back(std::move(connection));
+        }
+
+        void ConnectionTable::erase(std::uint32_t id) noexcept {
+            assert(id < m_indices.size());
+            assert(m_indices[id] != NONE);
+
+            const std::uint32_t index {m_indices[id]};
+
+            // Fill the gap with the last connection
+            if (index != m_connections.size() - 1) {
+                m_connections[index] = std::move(m_connections.back());
+                m_indices[m_connections[index]->get_id()] = index;
+            }
+
+            m_connections.pop_back();
+            m_indices[id] = NONE;
+        }
+
+        std::shared_ptr<ClientConnection> ConnectionTable::find(std::uint32_t id) const {
+            if (id >= m_indices.size() || m_indices[id] == NONE) {
+                return nullptr;
+            }
+
+            return m_connections[m_indices[id]];
+        }
+
+        ClientConnection* ConnectionTable::get(ConnectionHandle handle) const noexcept {
+            if (handle.id >= m_indices.size() || m_indices[handle.id] == NONE) {
+                return nullptr;
+            }
+
+            ClientConnection* connection {m_connections[m_indices[handle.id]].get()};
+
+            if (connection->handle() != handle) {
+                return nullptr;
+            }
+
+            return connection;
+        }
+
+        ClientConnection* ConnectionTable::get(std::uint32_t id) const noexcept {
+            if (id >= m_indices.size() || m_indices[id] == NONE) {
+                return nullptr;
+            }
+
+            return m_connections[m_indices[id]].get();
+        }
+
+        void ConnectionTable::clear() noexcept {
+            for (const auto& connection : m_connections) {
+                m_indices[connection->get_id()] = NONE;
+            }
+
+            m_connections.clear();
+        }
+    }
+}
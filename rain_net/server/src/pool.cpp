@@ -1,19 +1,73 @@
 #include "rain_net/internal/pool.hpp"
 
 #include <cassert>
+#include <limits>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
 
 namespace rain_net {
     namespace internal {
+        static constexpr std::uint32_t WORD_BITS {64};
+        static constexpr std::uint64_t FULL {std::numeric_limits<std::uint64_t>::max()};
+
+        // Index of the lowest set bit; value must not be zero
+        static std::uint32_t count_trailing_zeros(std::uint64_t value) noexcept {
+            assert(value != 0);
+
+#if defined(__GNUG__) || defined(__clang__)
+            return static_cast<std::uint32_t>(__builtin_ctzll(value));
+#elif defined(_MSC_VER)
+            unsigned long index {};
+            _BitScanForward64(&index, value);
+            return static_cast<std::uint32_t>(index);
+#else
+            std::uint32_t index {0};
+
+            while ((value & 1) == 0) {
+                value >>= 1;
+                index++;
+            }
+
+            return index;
+#endif
+        }
+
+        // The bits below the index
+        static std::uint64_t bits_below(std::uint32_t index) noexcept {
+            return (std::uint64_t(1) << index) - 1;
+        }
+
+        static std::uint32_t words_for(std::uint32_t bits) noexcept {
+            return static_cast<std::uint32_t>((std::uint64_t(bits) + WORD_BITS - 1) / WORD_BITS);
+        }
+
         void Pool::create(std::uint32_t pool_size) {
-            m_pool = std::make_unique<bool[]>(pool_size);
             m_size = pool_size;
+            m_word_count = words_for(pool_size);
+            m_full_word_count = words_for(m_word_count);
             m_id_pointer = 0;
+
+            m_words = std::make_unique<std::atomic<std::uint64_t>[]>(m_word_count);
+            m_full_words = std::make_unique<std::atomic<std::uint64_t>[]>(m_full_word_count);
+
+            // The bits past the end are always allocated
+            if (pool_size % WORD_BITS != 0) {
+                m_words[m_word_count - 1] = ~bits_below(pool_size % WORD_BITS);
+            }
+
+            if (m_word_count % WORD_BITS != 0) {
+                m_full_words[m_full_word_count - 1] = ~bits_below(m_word_count % WORD_BITS);
+            }
         }
 
-        std::optional<std::uint32_t> Pool::allocate_id() {
-            std::lock_guard<std::mutex> lock {m_mutex};
+        std::optional<std::uint32_t> Pool::allocate_id() noexcept {
+            if (m_size == 0) {
+                return std::nullopt;
+            }
 
-            const auto result {search_and_allocate_id(m_id_pointer, m_size)};
+            const auto result {search_and_allocate_id(m_id_pointer.load(std::memory_order_relaxed))};
 
             if (result != std::nullopt) {
                 return result;
@@ -21,24 +75,70 @@ namespace rain_net {
 
             // No ID found; start searching from the beginning
 
-            return search_and_allocate_id(0, m_id_pointer);
+            return search_and_allocate_id(0);
 
             // Return ID or null, if really nothing found
         }
 
-        void Pool::deallocate_id(std::uint32_t id) {
-            std::lock_guard<std::mutex> lock {m_mutex};
+        void Pool::deallocate_id(std::uint32_t id) noexcept {
+            assert(id < m_size);
+
+            const std::uint32_t word_index {id / WORD_BITS};
+            const std::uint64_t bit {std::uint64_t(1) << (id % WORD_BITS)};
+
+            [[maybe_unused]] const std::uint64_t previous {m_words[word_index].fetch_and(~bit)};
+
+            assert(previous & bit);
+
+            if (previous == FULL) {
+                m_full_words[word_index / WORD_BITS].fetch_and(~(std::uint64_t(1) << (word_index % WORD_BITS)));
+            }
+        }
+
+        std::optional<std::uint32_t> Pool::search_and_allocate_id(std::uint32_t begin) noexcept {
+            const std::uint32_t begin_word {begin / WORD_BITS};
+
+            for (std::uint32_t full_index {begin_word / WORD_BITS}; full_index < m_full_word_count; full_index++) {
+                std::uint64_t full_words {m_full_words[full_index].load(std::memory_order_acquire)};
 
-            assert(m_pool[id]);
+                // Skip the words before the beginning
+                if (full_index == begin_word / WORD_BITS) {
+                    full_words |= bits_below(begin_word % WORD_BITS);
+                }
 
-            m_pool[id] = false;
+                // Try every word that is not full; the bits are only hints, as other threads change the words
+                while (full_words != FULL) {
+                    const std::uint32_t bit_index {count_trailing_zeros(~full_words)};
+                    const std::uint32_t word_index {full_index * WORD_BITS + bit_index};
+
+                    const auto result {allocate_in_word(word_index, word_index == begin_word ? bits_below(begin % WORD_BITS) : 0)};
+
+                    if (result != std::nullopt) {
+                        return result;
+                    }
+
+                    full_words |= std::uint64_t(1) << bit_index;
+                }
+            }
+
+            return std::nullopt;
         }
 
-        std::optional<std::uint32_t> Pool::search_and_allocate_id(std::uint32_t begin, std::uint32_t end) noexcept {
-            for (std::uint32_t id {begin}; id < end; id++) {
-                if (!m_pool[id]) {
-                    m_pool[id] = true;
-                    m_id_pointer = (id + 1) % m_size;
+        std::optional<std::uint32_t> Pool::allocate_in_word(std::uint32_t word_index, std::uint64_t skip) noexcept {
+            auto& word {m_words[word_index]};
+            std::uint64_t bits {word.load(std::memory_order_relaxed)};
+
+            while ((bits | skip) != FULL) {
+                const std::uint32_t bit_index {count_trailing_zeros(~(bits | skip))};
+                const std::uint64_t new_bits {bits | (std::uint64_t(1) << bit_index)};
+
+                if (word.compare_exchange_weak(bits, new_bits, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                    if (new_bits == FULL) {
+                        mark_full(word_index);
+                    }
+
+                    const std::uint32_t id {word_index * WORD_BITS + bit_index};
+                    m_id_pointer.store((id + 1) % m_size, std::memory_order_relaxed);
 
                     return std::make_optional(id);
                 }
@@ -46,5 +146,17 @@ namespace rain_net {
 
             return std::nullopt;
         }
+
+        void Pool::mark_full(std::uint32_t word_index) noexcept {
+            auto& full_words {m_full_words[word_index / WORD_BITS]};
+            const std::uint64_t bit {std::uint64_t(1) << (word_index % WORD_BITS)};
+
+            full_words.fetch_or(bit);
+
+            // An ID may have been freed in the meantime, without seeing the mark
+            if (m_words[word_index].load() != FULL) {
+                full_words.fetch_and(~bit);
+            }
+        }
     }
 }
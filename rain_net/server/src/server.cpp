@@ -2,6 +2,13 @@
 
 #include <stdexcept>
 #include <cassert>
+#include <algorithm>
+#include <cstddef>
+#include <system_error>
+
+#ifndef _WIN32
+    #include <sys/socket.h>
+#endif
 
 #ifdef __GNUG__
     #pragma GCC diagnostic push
@@ -9,33 +16,120 @@
 #endif
 
 #include <asio/error_code.hpp>
+#include <asio/post.hpp>
+#include <asio/bind_allocator.hpp>
 
 #ifdef __GNUG__
     #pragma GCC diagnostic pop
 #endif
 
 #include "rain_net/internal/error.hpp"
+#include "rain_net/internal/buffer_pool.hpp"
 
 using namespace std::string_literals;
 
 namespace rain_net {
+#ifdef SO_REUSEPORT
+    namespace internal {
+        // Socket option for set_option(), as asio has none for SO_REUSEPORT
+        class ReusePort final {
+        public:
+            explicit ReusePort(bool value) noexcept
+                : m_value(value ? 1 : 0) {}
+
+            template<typename Protocol>
+            int level(const Protocol&) const noexcept { return SOL_SOCKET; }
+
+            template<typename Protocol>
+            int name(const Protocol&) const noexcept { return SO_REUSEPORT; }
+
+            template<typename Protocol>
+            const void* data(const Protocol&) const noexcept { return &m_value; }
+
+            template<typename Protocol>
+            std::size_t size(const Protocol&) const noexcept { return sizeof(m_value); }
+        private:
+            int m_value {};
+        };
+    }
+#endif
+
     Server::~Server() {
         stop();
     }
 
-    void Server::start(std::uint16_t port, std::uint32_t max_clients) {
-        if (m_asio_context.stopped()) {
-            m_asio_context.restart();
+    void Server::start(std::uint16_t port, std::uint32_t max_clients, const ConnectionOptions& options) {
+        ServerOptions server_options;
+        server_options.max_clients = max_clients;
+        server_options.connection = options;
+
+        start(port, server_options);
+    }
+
+    void Server::start(std::uint16_t port, const ServerOptions& options) {
+        const std::size_t io_threads {std::max(options.io_threads, std::size_t(1))};
+
+        // The event loops are never destroyed after stopping, because the connections may still refer to them
+        // Ones not needed anymore are set aside and are used again, when more are needed later
+        while (m_io_threads.size() > io_threads) {
+            m_spare_io_threads.push_back(std::move(m_io_threads.back()));
+            m_io_threads.pop_back();
+        }
+
+        while (m_io_threads.size() < io_threads) {
+            if (m_spare_io_threads.empty()) {
+                m_io_threads.push_back(std::make_unique<IoThread>());
+            } else {
+                m_io_threads.push_back(std::move(m_spare_io_threads.back()));
+                m_spare_io_threads.pop_back();
+            }
+        }
+
+        for (const auto& io_thread : m_io_threads) {
+            if (io_thread->context.stopped()) {
+                io_thread->context.restart();
+            }
+
+            if (!io_thread->receive_slab && options.registered_receive_buffers > 0) {
+                try {
+                    io_thread->receive_slab.emplace(
+                        io_thread->context,
+                        options.registered_receive_buffers,
+                        internal::ReceiveBuffer::CAPACITY
+                    );
+                } catch (const std::system_error& e) {
+                    // Connections use their own buffers then
+                    m_on_log("Could not register receive buffers: " + std::string(e.what()));
+                }
+            }
+
+            io_thread->work.emplace(io_thread->context.get_executor());
         }
 
-        m_pool.create(max_clients);
+        m_connection_options = options.connection;
+        m_next_io_thread = 0;
+        m_next_incoming_messages = 0;
+
+        m_pool.create(options.max_clients);
+        m_connections.create(options.max_clients);
+        m_grid.create(options.interest_cell_size);
 
         const auto endpoint {asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)};
 
+#ifdef SO_REUSEPORT
+        m_sharded_acceptors = options.reuse_port && m_io_threads.size() > 1;
+#else
+        m_sharded_acceptors = false;
+#endif
+
         try {
-            m_acceptor.open(endpoint.protocol());
-            m_acceptor.bind(endpoint);
-            m_acceptor.listen();
+            if (m_sharded_acceptors) {
+                for (const auto& io_thread : m_io_threads) {
+                    open_acceptor(io_thread->acceptor, endpoint, true);
+                }
+            } else {
+                open_acceptor(m_io_threads.front()->acceptor, endpoint, options.reuse_port);
+            }
         } catch (const std::system_error& e) {
             m_on_log("Unexpected error: "s + e.what());
             throw ConnectionError(e.what());
@@ -43,173 +137,600 @@ namespace rain_net {
 
         m_running = true;
 
-        task_accept_connection();
-
-        m_context_thread = std::thread([this]() {
-            try {
-                m_asio_context.run();
-            } catch (const std::system_error& e) {
-                m_on_log("Unexpected error: "s + e.what());
-                m_error = std::make_exception_ptr(ConnectionError(e.what()));
-            } catch (const ConnectionError& e) {
-                m_on_log("Unexpected error: "s + e.what());
-                m_error = std::current_exception();
+        if (m_sharded_acceptors) {
+            for (const auto& io_thread : m_io_threads) {
+                task_accept_connection(*io_thread);
             }
-        });
+        } else {
+            task_accept_connection(*m_io_threads.front());
+        }
+
+        for (const auto& io_thread : m_io_threads) {
+            io_thread->thread = std::thread([this, &context = io_thread->context]() {
+                try {
+                    context.run();
+                } catch (const std::system_error& e) {
+                    m_on_log("Unexpected error: "s + e.what());
+                    set_error(std::make_exception_ptr(ConnectionError(e.what())));
+                } catch (const ConnectionError& e) {
+                    m_on_log("Unexpected error: "s + e.what());
+                    set_error(std::current_exception());
+                }
+            });
+        }
+
+        m_on_log(
+            "Server started (port " + std::to_string(port) +
+            ", max " + std::to_string(options.max_clients) + " clients" +
+            ", " + std::to_string(io_threads) + " io threads" +
+            (m_sharded_acceptors ? ", reuse port)" : ")")
+        );
+    }
+
+    void Server::set_on_message(std::function<void(Message, std::shared_ptr<ClientConnection>)> on_message) {
+        assert(!m_running);
 
-        m_on_log("Server started (port " + std::to_string(port) + ", max " + std::to_string(max_clients) + " clients)");
+        m_on_message = std::move(on_message);
     }
 
     void Server::stop() {
         m_running = false;
 
-        // Don't prime the context, if it has been stopped,
-        // because it will do the work after restart, meaning use after free
-        if (!m_asio_context.stopped()) {
-            for (const auto& connection : m_connections) {
-                if (connection != nullptr) {
-                    connection->close();
-                }
+        for (const auto& connection : m_connections) {
+            assert(connection != nullptr);
+
+            // Don't prime the context, if it has been stopped,
+            // because it will do the work after restart, meaning use after free
+            if (!connection->m_asio_context.stopped()) {
+                connection->close();
             }
-        }
 
-        if (m_acceptor.is_open()) {
-            try {
-                m_acceptor.close();
-            } catch (const std::system_error&) {}
+            // The connections and the groups go away all at once, so don't let them be removed later
+            connection->m_used = true;
+            connection->m_groups.clear();
         }
 
-        if (m_context_thread.joinable()) {
-            m_context_thread.join();
+        for (const auto& io_thread : m_io_threads) {
+            if (io_thread->acceptor.is_open()) {
+                try {
+                    io_thread->acceptor.close();
+                } catch (const std::system_error&) {}
+            }
+
+            // Let the event loop finish, once all the work is done
+            io_thread->work.reset();
         }
 
-        for (auto& connection : m_connections) {
-            connection.reset();
+        for (const auto& io_thread : m_io_threads) {
+            if (io_thread->thread.joinable()) {
+                io_thread->thread.join();
+            }
+
+            // A thread that ended early because of an error left work behind, which may refer to the connections
+            // Finish it here, while the connections are still alive
+            while (!io_thread->context.stopped()) {
+                try {
+                    io_thread->context.run();
+                } catch (const std::exception&) {}
+            }
         }
 
+        m_groups.clear();
+        m_grid.clear();
         m_connections.clear();
 
         m_new_connections.clear();
 
-        m_incoming_messages.clear();
+        for (const auto& io_thread : m_io_threads) {
+            io_thread->incoming_messages.clear();
+        }
     }
 
     void Server::accept_connections() {
         throw_if_error();
 
-        // This function may only pop m_connections and the accepting thread may only push m_connections
+        // This function may only pop m_new_connections and the accepting threads may only push m_new_connections
 
         while (!m_new_connections.empty()) {
             const auto connection {m_new_connections.pop_front()};
 
             if (m_on_client_connected(*this, connection)) {
-                m_connections.push_front(connection);
+                m_connections.insert(connection);
                 connection->start_communication();
             } else {
                 // The server side code must not keep any reference to the connection at this point
                 // Must close the socket immediately
 
-                connection->m_tcp_socket.close();
+                connection->close_socket();
                 m_pool.deallocate_id(connection->get_id());
             }
         }
+
+        reset_event();
     }
 
-    std::pair<Message, std::shared_ptr<ClientConnection>> Server::next_message() {
-        return m_incoming_messages.pop_front();
+    std::pair<Message, ConnectionHandle> Server::next_message() {
+        assert(has_incoming_messages());
+
+        // Take turns among the event loops, one message each, so that a busy one doesn't starve the others
+        while (true) {
+            auto& incoming_messages {m_io_threads[m_next_incoming_messages]->incoming_messages};
+            m_next_incoming_messages = (m_next_incoming_messages + 1) % m_io_threads.size();
+
+            if (!incoming_messages.empty()) {
+                auto message {incoming_messages.pop_front()};
+
+                if (!has_incoming_messages()) {
+                    reset_event();
+                }
+
+                return message;
+            }
+        }
     }
 
     bool Server::available_messages() const {
-        return !m_incoming_messages.empty();
+        return has_incoming_messages();
+    }
+
+    bool Server::wait_for_messages(std::chrono::nanoseconds timeout, std::chrono::nanoseconds spin) {
+        return m_notifier.wait(timeout, spin, [this]() {
+            return (
+                has_incoming_messages() ||
+                !m_new_connections.empty() ||
+                m_error_occurred.load(std::memory_order_acquire)
+            );
+        }) && !m_error_occurred.load(std::memory_order_acquire);
+    }
+
+    std::size_t Server::drain_messages(std::vector<std::pair<Message, ConnectionHandle>>& messages, std::size_t max) {
+        std::size_t count {0};
+
+        for (std::size_t i {0}; i < m_io_threads.size() && count < max; i++) {
+            count += m_io_threads[m_next_incoming_messages]->incoming_messages.pop_front(messages, max - count);
+            m_next_incoming_messages = (m_next_incoming_messages + 1) % m_io_threads.size();
+        }
+
+        if (!has_incoming_messages()) {
+            reset_event();
+        }
+
+        return count;
+    }
+
+    int Server::event_handle() {
+        return m_notifier.event_handle();
     }
 
     void Server::check_connections() {
         throw_if_error();
 
-        for (auto before_iter {m_connections.before_begin()}, iter {m_connections.begin()}; iter != m_connections.end(); before_iter++, iter++) {
-            const auto& connection {*iter};
+        for (std::size_t i {0}; i < m_connections.size();) {
+            const auto& connection {m_connections[i]};
 
             assert(connection != nullptr);
 
             if (!connection->is_open()) {
-                if (maybe_client_disconnected(connection, iter, before_iter)) {
-                    break;
-                }
+                // The last connection takes its place
+                maybe_client_disconnected(connection);
+                continue;
             }
+
+            i++;
         }
     }
 
-    void Server::send_message(std::shared_ptr<ClientConnection> connection, const Message& message) {
+    std::shared_ptr<ClientConnection> Server::connection(std::uint32_t id) const {
+        return m_connections.find(id);
+    }
+
+    std::shared_ptr<ClientConnection> Server::connection(ConnectionHandle handle) const {
+        if (m_connections.get(handle) == nullptr) {
+            return nullptr;
+        }
+
+        return m_connections.find(handle.id);
+    }
+
+    bool Server::send_message(std::shared_ptr<ClientConnection> connection, const Message& message, const SendOptions& options) {
         throw_if_error();
 
         assert(connection != nullptr);
 
         if (!connection->is_open()) {
             maybe_client_disconnected(connection);
-            return;
+            return false;
+        }
+
+        return connection->send(message, options);
+    }
+
+    bool Server::send_message(std::shared_ptr<ClientConnection> connection, const SharedMessage& message, const SendOptions& options) {
+        throw_if_error();
+
+        assert(connection != nullptr);
+
+        if (!connection->is_open()) {
+            maybe_client_disconnected(connection);
+            return false;
         }
 
-        connection->send(message);
+        return connection->send(message, options);
     }
 
-    void Server::send_message_broadcast(const Message& message) {
+    bool Server::send_message(ConnectionHandle connection, const Message& message, const SendOptions& options) {
         throw_if_error();
 
-        for (auto before_iter {m_connections.before_begin()}, iter {m_connections.begin()}; iter != m_connections.end(); before_iter++, iter++) {
-            const auto& connection {*iter};
+        ClientConnection* const client_connection {m_connections.get(connection)};
+
+        if (client_connection == nullptr) {
+            return false;
+        }
+
+        if (!client_connection->is_open()) {
+            maybe_client_disconnected(m_connections.find(connection.id));
+            return false;
+        }
+
+        return client_connection->send_unowned(message, options);
+    }
+
+    bool Server::send_message(ConnectionHandle connection, const SharedMessage& message, const SendOptions& options) {
+        throw_if_error();
+
+        ClientConnection* const client_connection {m_connections.get(connection)};
+
+        if (client_connection == nullptr) {
+            return false;
+        }
+
+        if (!client_connection->is_open()) {
+            maybe_client_disconnected(m_connections.find(connection.id));
+            return false;
+        }
+
+        return client_connection->send_unowned(message, options);
+    }
+
+    void Server::send_message_broadcast(const Message& message, const SendOptions& options) {
+        send_message_broadcast(SharedMessage(message), options);
+    }
+
+    void Server::send_message_broadcast(const SharedMessage& message, const SendOptions& options) {
+        throw_if_error();
+
+        for (std::size_t i {0}; i < m_connections.size();) {
+            const auto& connection {m_connections[i]};
 
             assert(connection != nullptr);
 
             if (!connection->is_open()) {
-                if (maybe_client_disconnected(connection, iter, before_iter)) {
-                    break;
-                }
-
+                // The last connection takes its place
+                maybe_client_disconnected(connection);
                 continue;
             }
 
-            connection->send(message);
+            connection->send_unowned(message, options);
+            i++;
         }
     }
 
-    void Server::send_message_broadcast(const Message& message, std::shared_ptr<ClientConnection> exception) {
+    void Server::send_message_broadcast(const Message& message, std::shared_ptr<ClientConnection> exception, const SendOptions& options) {
+        send_message_broadcast(SharedMessage(message), std::move(exception), options);
+    }
+
+    void Server::send_message_broadcast(const SharedMessage& message, std::shared_ptr<ClientConnection> exception, const SendOptions& options) {
+        send_message_broadcast(message, exception != nullptr ? exception->handle() : ConnectionHandle(), options);
+    }
+
+    void Server::send_message_broadcast(const Message& message, ConnectionHandle exception, const SendOptions& options) {
+        send_message_broadcast(SharedMessage(message), exception, options);
+    }
+
+    void Server::send_message_broadcast(const SharedMessage& message, ConnectionHandle exception, const SendOptions& options) {
         throw_if_error();
 
-        for (auto before_iter {m_connections.before_begin()}, iter {m_connections.begin()}; iter != m_connections.end(); before_iter++, iter++) {
-            const auto& connection {*iter};
+        for (std::size_t i {0}; i < m_connections.size();) {
+            const auto& connection {m_connections[i]};
 
             assert(connection != nullptr);
 
-            if (connection == exception) {
+            if (!connection->is_open()) {
+                // The last connection takes its place
+                maybe_client_disconnected(connection);
                 continue;
             }
 
-            if (!connection->is_open()) {
-                if (maybe_client_disconnected(connection, iter, before_iter)) {
-                    break;
-                }
+            if (connection->handle() != exception) {
+                connection->send_unowned(message, options);
+            }
+
+            i++;
+        }
+    }
+
+    Server::GroupId Server::create_group() {
+        const GroupId group {m_next_group++};
 
+        // The member lists are made on joining, as the io threads may not exist yet
+        m_groups.emplace(group, Group());
+
+        return group;
+    }
+
+    void Server::destroy_group(GroupId group) {
+        const auto iter {m_groups.find(group)};
+
+        if (iter == m_groups.end()) {
+            return;
+        }
+
+        for (const auto& members : iter->second.members) {
+            if (members == nullptr) {
                 continue;
             }
 
-            connection->send(message);
+            for (const auto& connection : *members) {
+                auto& groups {connection->m_groups};
+                groups.erase(std::find(groups.begin(), groups.end(), group));
+            }
         }
+
+        m_groups.erase(iter);
+    }
+
+    bool Server::join_group(GroupId group, ConnectionHandle connection) {
+        const auto iter {m_groups.find(group)};
+
+        if (iter == m_groups.end()) {
+            return false;
+        }
+
+        ClientConnection* const client_connection {m_connections.get(connection)};
+
+        if (client_connection == nullptr) {
+            return false;
+        }
+
+        auto& groups {client_connection->m_groups};
+
+        if (std::find(groups.begin(), groups.end(), group) != groups.end()) {
+            return false;
+        }
+
+        auto& io_thread_members {iter->second.members};
+
+        if (io_thread_members.size() < m_io_threads.size()) {
+            io_thread_members.resize(m_io_threads.size());
+        }
+
+        auto& members {io_thread_members[io_thread_index(*client_connection)]};
+
+        auto new_members {members != nullptr ? std::make_shared<GroupMembers>(*members) : std::make_shared<GroupMembers>()};
+        new_members->push_back(m_connections.find(connection.id));
+        members = std::move(new_members);
+
+        iter->second.size++;
+        groups.push_back(group);
+
+        return true;
+    }
+
+    bool Server::leave_group(GroupId group, ConnectionHandle connection) {
+        const auto iter {m_groups.find(group)};
+
+        if (iter == m_groups.end()) {
+            return false;
+        }
+
+        ClientConnection* const client_connection {m_connections.get(connection)};
+
+        if (client_connection == nullptr) {
+            return false;
+        }
+
+        auto& groups {client_connection->m_groups};
+        const auto group_iter {std::find(groups.begin(), groups.end(), group)};
+
+        if (group_iter == groups.end()) {
+            return false;
+        }
+
+        groups.erase(group_iter);
+        remove_from_group(iter->second, *client_connection);
+
+        return true;
+    }
+
+    std::size_t Server::group_size(GroupId group) const {
+        assert(m_groups.find(group) != m_groups.end());
+
+        return m_groups.at(group).size;
+    }
+
+    void Server::send_message_group(GroupId group, const Message& message, const SendOptions& options) {
+        send_message_group(group, SharedMessage(message), options);
+    }
+
+    void Server::send_message_group(GroupId group, const SharedMessage& message, const SendOptions& options) {
+        throw_if_error();
+
+        const auto iter {m_groups.find(group)};
+
+        assert(iter != m_groups.end());
+
+        if (iter == m_groups.end()) {
+            return;
+        }
+
+        const auto& members {iter->second.members};
+
+        for (std::size_t i {0}; i < members.size(); i++) {
+            if (members[i] == nullptr || members[i]->empty()) {
+                continue;
+            }
+
+            // A single task per io thread; only the references to the member list and to the message are copied
+            asio::post(m_io_threads[i]->context, asio::bind_allocator(internal::PoolAllocator<void>(),
+                [members = members[i], message, options]() {
+                    for (const auto& connection : *members) {
+                        if (!connection->is_open() || !connection->admit_outgoing(message.size(), options)) {
+                            continue;
+                        }
+
+                        connection->queue_message(message, options);
+                    }
+                }
+            ));
+        }
+    }
+
+    bool Server::set_position(ConnectionHandle connection, Position position) {
+        if (m_connections.get(connection) == nullptr) {
+            return false;
+        }
+
+        m_grid.set_position(connection.id, position);
+
+        return true;
+    }
+
+    bool Server::clear_position(ConnectionHandle connection) {
+        if (m_connections.get(connection) == nullptr) {
+            return false;
+        }
+
+        m_grid.remove(connection.id);
+
+        return true;
+    }
+
+    void Server::send_message_in_radius(Position position, float radius, const Message& message, const SendOptions& options) {
+        send_message_in_radius(position, radius, SharedMessage(message), options);
+    }
+
+    void Server::send_message_in_radius(Position position, float radius, const SharedMessage& message, const SendOptions& options) {
+        throw_if_error();
+
+        m_grid.query(position, radius, [&](std::uint32_t id) {
+            ClientConnection* const connection {m_connections.get(id)};
+
+            // Disconnected clients are left for check_connections(), as the grid must not change meanwhile
+            if (connection == nullptr || !connection->is_open()) {
+                return;
+            }
+
+            connection->send_unowned(message, options);
+        });
     }
 
     void Server::throw_if_error() {
-        if (m_error) {
+        if (m_error_occurred.load(std::memory_order_acquire)) {
             stop();
 
-            const auto error {std::exchange(m_error, nullptr)};
+            std::exception_ptr error;
+
+            {
+                std::lock_guard<std::mutex> lock {m_error_mutex};
+                error = std::exchange(m_error, nullptr);
+                m_error_occurred.store(false);
+            }
+
             std::rethrow_exception(error);
         }
     }
 
-    void Server::task_accept_connection() {
-        // In this thread IDs are allocated, but in the main thread they are freed
+    void Server::set_error(std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock {m_error_mutex};
+
+            // Only the first error is reported
+            if (m_error_occurred.load(std::memory_order_relaxed)) {
+                return;
+            }
+
+            m_error = std::move(error);
+            m_error_occurred.store(true, std::memory_order_release);
+        }
+
+        // Wake up the main thread, so that it can see the error
+        m_notifier.notify();
+    }
+
+    void Server::reset_event() {
+        m_notifier.reset_event([this]() {
+            return has_incoming_messages() || !m_new_connections.empty();
+        });
+    }
 
-        m_acceptor.async_accept(
-            [this](asio::error_code ec, asio::ip::tcp::socket socket) {
+    bool Server::has_incoming_messages() const {
+        for (const auto& io_thread : m_io_threads) {
+            if (!io_thread->incoming_messages.empty()) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    Server::IoThread& Server::next_io_thread() {
+        IoThread& io_thread {*m_io_threads[m_next_io_thread]};
+        m_next_io_thread = (m_next_io_thread + 1) % m_io_threads.size();
+
+        return io_thread;
+    }
+
+    std::size_t Server::io_thread_index(const ClientConnection& connection) const {
+        for (std::size_t i {0}; i < m_io_threads.size(); i++) {
+            if (&m_io_threads[i]->context == &connection.m_asio_context) {
+                return i;
+            }
+        }
+
+        assert(false);
+        return 0;
+    }
+
+    void Server::remove_from_group(Group& group, const ClientConnection& connection) {
+        auto& members {group.members[io_thread_index(connection)]};
+
+        assert(members != nullptr);
+
+        auto new_members {std::make_shared<GroupMembers>()};
+        new_members->reserve(members->size() - 1);
+
+        for (const auto& member : *members) {
+            if (member.get() != &connection) {
+                new_members->push_back(member);
+            }
+        }
+
+        members = std::move(new_members);
+        group.size--;
+    }
+
+    void Server::open_acceptor(asio::ip::tcp::acceptor& acceptor, const asio::ip::tcp::endpoint& endpoint, [[maybe_unused]] bool reuse_port) {
+        acceptor.open(endpoint.protocol());
+
+#ifdef SO_REUSEPORT
+        if (reuse_port) {
+            acceptor.set_option(internal::ReusePort(true));
+        }
+#endif
+
+        acceptor.bind(endpoint);
+        acceptor.listen();
+    }
+
+    void Server::task_accept_connection(IoThread& acceptor_thread) {
+        // In these threads IDs are allocated, but in the main thread they are freed
+
+        // The socket of the new connection goes straight to the event loop that is going to serve it
+        // Sharded acceptors keep their connections, as the kernel has balanced them already
+        IoThread& io_thread {m_sharded_acceptors ? acceptor_thread : next_io_thread()};
+
+        acceptor_thread.acceptor.async_accept(io_thread.context,
+            [this, &acceptor_thread, &io_thread](asio::error_code ec, asio::ip::tcp::socket socket) {
                 if (ec) {
                     m_on_log("Could not accept new connection: " + ec.message());
                 } else {
@@ -227,15 +748,29 @@ namespace rain_net {
 
                         m_on_log("Actively rejected connection; ran out of IDs");
                     } else {
+                        std::uint32_t generation {m_next_generation.fetch_add(1, std::memory_order_relaxed)};
+
+                        // Zero is reserved for the empty handle
+                        if (generation == 0) {
+                            generation = m_next_generation.fetch_add(1, std::memory_order_relaxed);
+                        }
+
                         m_new_connections.push_back(
                             std::make_shared<ClientConnection>(
-                                m_asio_context,
+                                io_thread.context,
                                 std::move(socket),
-                                m_incoming_messages,
+                                io_thread.incoming_messages,
+                                m_notifier,
                                 *new_id,
-                                m_on_log
+                                generation,
+                                m_on_log,
+                                m_on_message,
+                                m_connection_options,
+                                io_thread.receive_slab ? &*io_thread.receive_slab : nullptr
                             )
                         );
+
+                        m_notifier.notify();
                     }
                 }
 
@@ -243,7 +778,7 @@ namespace rain_net {
                     return;
                 }
 
-                task_accept_connection();
+                task_accept_connection(acceptor_thread);
             }
         );
     }
@@ -253,23 +788,23 @@ namespace rain_net {
             return;
         }
 
-        m_on_client_disconnected(*this, connection);
-        m_pool.deallocate_id(connection->get_id());
-        m_connections.remove(connection);
-
+        // Remove it first, so that the callback sees the table without it
+        m_connections.erase(connection->get_id());
         connection->m_used = true;
-    }
 
-    bool Server::maybe_client_disconnected(std::shared_ptr<ClientConnection> connection, ConnectionsIter& iter, ConnectionsIter before_iter) {
-        if (connection->m_used) {
-            return false;
+        for (const GroupId group : connection->m_groups) {
+            remove_from_group(m_groups.at(group), *connection);
         }
 
+        connection->m_groups.clear();
+
+        m_grid.remove(connection->get_id());
+
         m_on_client_disconnected(*this, connection);
         m_pool.deallocate_id(connection->get_id());
 
-        connection->m_used = true;
-
-        return (iter = m_connections.erase_after(before_iter)) == m_connections.end();
+        // Sends from the server don't keep the connection alive, so let it go only after its event loop has run them
+        auto& asio_context {connection->m_asio_context};
+        asio::post(asio_context, [connection = std::move(connection)]() {});
     }
 }
@@ -0,0 +1,97 @@
+#include "rain_net/internal/spatial_grid.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+namespace rain_net {
+    namespace internal {
+        // Keep the cell coordinates well within 32 bits, even for absurd positions
+        static constexpr double MAX_CELL_COORDINATE {1 << 30};
+
+        void SpatialGrid::create(float cell_size) {
+            assert(cell_size > 0.0f);
+
+            m_cell_size = cell_size;
+
+            clear();
+        }
+
+        void SpatialGrid::set_position(std::uint32_t id, Position position) {
+            if (id >= m_entries.size()) {
+                m_entries.resize(std::size_t(id) + 1);
+            }
+
+            Entry& entry {m_entries[id]};
+            const std::uint64_t cell {cell_key(cell_coordinate(position.x), cell_coordinate(position.y))};
+
+            entry.position = position;
+
+            // Most of the time, clients move within their cell
+            if (entry.index != NONE && entry.cell == cell) {
+                return;
+            }
+
+            if (entry.index != NONE) {
+                remove_from_cell(id);
+            }
+
+            auto& ids {m_cells[cell]};
+
+            entry.cell = cell;
+            entry.index = static_cast<std::uint32_t>(ids.size());
+            ids.push_back(id);
+        }
+
+        void SpatialGrid::remove(std::uint32_t id) noexcept {
+            if (id >= m_entries.size() || m_entries[id].index == NONE) {
+                return;
+            }
+
+            remove_from_cell(id);
+        }
+
+        void SpatialGrid::clear() noexcept {
+            m_cells.clear();
+            m_entries.clear();
+        }
+
+        std::int64_t SpatialGrid::cell_coordinate(float value) const noexcept {
+            const double coordinate {std::floor(static_cast<double>(value) / static_cast<double>(m_cell_size))};
+
+            // Also maps NaN to a valid cell
+            if (!(coordinate > -MAX_CELL_COORDINATE)) {
+                return -static_cast<std::int64_t>(MAX_CELL_COORDINATE);
+            }
+
+            return static_cast<std::int64_t>(std::min(coordinate, MAX_CELL_COORDINATE));
+        }
+
+        std::uint64_t SpatialGrid::cell_key(std::int64_t x, std::int64_t y) noexcept {
+            return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32) | static_cast<std::uint32_t>(y);
+        }
+
+        void SpatialGrid::remove_from_cell(std::uint32_t id) noexcept {
+            Entry& entry {m_entries[id]};
+
+            const auto iter {m_cells.find(entry.cell)};
+
+            assert(iter != m_cells.end());
+
+            auto& ids {iter->second};
+
+            // Fill the gap with the last client
+            if (entry.index != ids.size() - 1) {
+                ids[entry.index] = ids.back();
+                m_entries[ids[entry.index]].index = entry.index;
+            }
+
+            ids.pop_back();
+            entry.index = NONE;
+
+            if (ids.empty()) {
+                m_cells.erase(iter);
+            }
+        }
+    }
+}
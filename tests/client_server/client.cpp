@@ -49,7 +49,7 @@ int main() {
     try {
         client.connect("localhost", 6001);
 
-        while (!client.connection_established()) {
+        while (!client.wait_for_connection(std::chrono::milliseconds(100))) {
             if (!running) {
                 return 0;
             }
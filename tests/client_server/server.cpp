@@ -1,5 +1,9 @@
 #include <iostream>
 #include <csignal>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <chrono>
 
 #include <rain_net/server.hpp>
 
@@ -19,10 +23,10 @@ static void on_log(const std::string& message) {
     std::cerr << message << '\n';
 }
 
-static void handle_message(rain_net::Server& server, const rain_net::Message& message, std::shared_ptr<rain_net::ClientConnection> connection) {
+static void handle_message(rain_net::Server& server, const rain_net::Message& message, rain_net::ConnectionHandle connection) {
     switch (message.id()) {
         case MessgeType::PingServer:
-            std::cout << "Ping request from " << connection->get_id() << '\n';
+            std::cout << "Ping request from " << connection.id << '\n';
 
             // Just send the same message back
             server.send_message(connection, message);
@@ -44,15 +48,21 @@ int main() {
 
     rain_net::Server server {on_client_connected, on_client_disconnected, on_log};
 
+    std::vector<std::pair<rain_net::Message, rain_net::ConnectionHandle>> messages;
+
     try {
         server.start(6001);
 
         while (running) {
+            // Sleep until there is something to do, instead of spinning
+            server.wait_for_messages(std::chrono::milliseconds(100));
+
             server.accept_connections();
 
-            while (server.available_messages()) {
-                const auto& [message, connection] {server.next_message()};
+            messages.clear();
+            server.drain_messages(messages);
 
+            for (const auto& [message, connection] : messages) {
                 handle_message(server, message, connection);
             }
         }
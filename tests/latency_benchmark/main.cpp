@@ -0,0 +1,171 @@
+#include <iostream>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <utility>
+#include <memory>
+
+#ifdef __unix__
+    #include <sys/resource.h>
+#endif
+
+#include <rain_net/server.hpp>
+#include <rain_net/client.hpp>
+
+// Bounce small messages between a client and an echo server over loopback and report the round trip latencies
+// Build it once normally and once with RAIN_NET_IO_URING to compare epoll against io_uring on the same workload
+// The server reads into registered receive buffers with both backends; with epoll, they are ordinary memory
+// Syscalls are not counted here; see the README for measuring them per message
+
+static constexpr std::uint16_t PORT {6100};
+static constexpr std::size_t ROUND_TRIPS {20000};
+static constexpr std::size_t PIPELINED {100000};
+static constexpr std::size_t IN_FLIGHT {64};
+static constexpr std::size_t REGISTERED_RECEIVE_BUFFERS {16};
+
+static long context_switches() {
+#ifdef __unix__
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+#else
+    return 0;
+#endif
+}
+
+static void echo_server(rain_net::Server& server, const std::atomic_bool& running) {
+    std::vector<std::pair<rain_net::Message, rain_net::ConnectionHandle>> messages;
+
+    while (running) {
+        server.wait_for_messages(std::chrono::milliseconds(10));
+        server.accept_connections();
+
+        messages.clear();
+        server.drain_messages(messages);
+
+        for (const auto& [message, connection] : messages) {
+            server.send_message(connection, message);
+        }
+    }
+}
+
+static void ping_pong(rain_net::Client& client) {
+    std::vector<double> latencies;
+    latencies.reserve(ROUND_TRIPS);
+
+    const long switches {context_switches()};
+
+    for (std::size_t i {0}; i < ROUND_TRIPS; i++) {
+        rain_net::Message message {1};
+        message << static_cast<std::uint64_t>(i);
+
+        const auto begin {std::chrono::steady_clock::now()};
+
+        client.send_message(message);
+
+        while (!client.wait_for_messages(std::chrono::seconds(1))) {}
+
+        client.next_message();
+
+        const auto end {std::chrono::steady_clock::now()};
+
+        latencies.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+    }
+
+    const double switches_per_message {static_cast<double>(context_switches() - switches) / static_cast<double>(ROUND_TRIPS)};
+
+    std::sort(latencies.begin(), latencies.end());
+
+    const auto percentile {[&latencies](double p) {
+        return latencies[std::min(latencies.size() - 1, static_cast<std::size_t>(p * static_cast<double>(latencies.size())))];
+    }};
+
+    std::cout << "round trip (us)\tp50\tp99\tp99.9\tmax\tcontext switches/message\n";
+    std::cout << '\t' << percentile(0.5) << '\t' << percentile(0.99) << '\t' << percentile(0.999) << '\t' << latencies.back();
+    std::cout << '\t' << switches_per_message << '\n';
+}
+
+static void pipelined(rain_net::Client& client) {
+    std::vector<rain_net::Message> messages;
+    std::size_t sent {0};
+    std::size_t received {0};
+
+    const long switches {context_switches()};
+    const auto begin {std::chrono::steady_clock::now()};
+
+    while (received < PIPELINED) {
+        while (sent < PIPELINED && sent - received < IN_FLIGHT) {
+            rain_net::Message message {1};
+            message << static_cast<std::uint64_t>(sent);
+
+            client.send_message(message);
+            sent++;
+        }
+
+        client.wait_for_messages(std::chrono::seconds(1));
+
+        messages.clear();
+        received += client.drain_messages(messages);
+    }
+
+    const auto end {std::chrono::steady_clock::now()};
+    const double seconds {std::chrono::duration<double>(end - begin).count()};
+    const double switches_per_message {static_cast<double>(context_switches() - switches) / static_cast<double>(PIPELINED)};
+
+    std::cout << "pipelined\tmessages/s\tcontext switches/message\n";
+    std::cout << '\t' << static_cast<double>(PIPELINED) / seconds << '\t' << switches_per_message << '\n';
+}
+
+int main() {
+    std::cout << "backend: " << (rain_net::internal::IO_URING ? "io_uring" : "default") << '\n';
+
+    rain_net::Server server {
+        [](rain_net::Server&, std::shared_ptr<rain_net::ClientConnection>) { return true; },
+        [](rain_net::Server&, std::shared_ptr<rain_net::ClientConnection>) {}
+    };
+
+    rain_net::ServerOptions options;
+    options.registered_receive_buffers = REGISTERED_RECEIVE_BUFFERS;
+
+    std::atomic_bool running {true};
+
+    try {
+        server.start(PORT, options);
+    } catch (const rain_net::ConnectionError& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    std::thread server_thread {[&server, &running]() {
+        try {
+            echo_server(server, running);
+        } catch (const rain_net::ConnectionError& e) {
+            std::cerr << e.what() << '\n';
+        }
+    }};
+
+    rain_net::Client client;
+
+    try {
+        client.connect("localhost", PORT);
+
+        while (!client.wait_for_connection(std::chrono::seconds(1))) {}
+
+        ping_pong(client);
+        pipelined(client);
+    } catch (const rain_net::ConnectionError& e) {
+        std::cerr << e.what() << '\n';
+    }
+
+    client.disconnect();
+
+    running = false;
+    server_thread.join();
+
+    server.stop();
+}
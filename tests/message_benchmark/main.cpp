@@ -0,0 +1,116 @@
+#include <iostream>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#include <rain_net/internal/message.hpp>
+
+// Build messages of increasing field counts and report the cost per written field
+// With geometric growth the cost per field should stay roughly constant
+// Also count the calls to the global allocator done on the send and receive paths; small payloads are stored inline
+// and bigger ones are recycled by the buffer pool, so in steady state there should be none
+
+static constexpr std::size_t ITERATIONS {2000};
+
+static std::size_t allocations {0};
+
+void* operator new(std::size_t size) {
+    allocations++;
+
+    if (void* pointer {std::malloc(size > 0 ? size : 1)}) {
+        return pointer;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+static double build_messages(std::size_t fields, bool reserve) {
+    std::uint64_t checksum {0};
+
+    const auto begin {std::chrono::steady_clock::now()};
+
+    for (std::size_t i {0}; i < ITERATIONS; i++) {
+        rain_net::Message message {1};
+
+        if (reserve) {
+            message.reserve(fields * sizeof(std::uint32_t));
+        }
+
+        for (std::size_t j {0}; j < fields; j++) {
+            message << static_cast<std::uint32_t>(j);
+        }
+
+        checksum += message.size();
+    }
+
+    const auto end {std::chrono::steady_clock::now()};
+
+    if (checksum != ITERATIONS * (fields * sizeof(std::uint32_t) + rain_net::internal::HEADER_SIZE)) {
+        std::cerr << "Invalid message size\n";
+    }
+
+    return std::chrono::duration<double, std::nano>(end - begin).count() / static_cast<double>(ITERATIONS * fields);
+}
+
+static double allocations_send(std::size_t fields) {
+    const std::size_t begin {allocations};
+
+    for (std::size_t i {0}; i < ITERATIONS; i++) {
+        rain_net::Message message {1};
+
+        for (std::size_t j {0}; j < fields; j++) {
+            message << static_cast<std::uint32_t>(j);
+        }
+
+        // Like when sending
+        const rain_net::SharedMessage shared {std::move(message)};
+    }
+
+    return static_cast<double>(allocations - begin) / static_cast<double>(ITERATIONS);
+}
+
+static double allocations_receive(std::size_t fields) {
+    const std::size_t begin {allocations};
+
+    for (std::size_t i {0}; i < ITERATIONS; i++) {
+        // Do what the connections do when reading a message
+        rain_net::internal::BasicMessage incoming;
+        incoming.header.id = 1;
+        incoming.header.payload_size = static_cast<std::uint32_t>(fields * sizeof(std::uint32_t));
+        incoming.payload.reserve(incoming.header.payload_size, 0);
+
+        const rain_net::Message message {std::move(incoming)};
+    }
+
+    return static_cast<double>(allocations - begin) / static_cast<double>(ITERATIONS);
+}
+
+int main() {
+    std::cout << "fields\tallocations/message (send)\tallocations/message (receive)\n";
+
+    for (std::size_t fields {1}; fields <= 4096; fields *= 4) {
+        std::cout << fields << '\t' << allocations_send(fields) << '\t' << allocations_receive(fields) << '\n';
+    }
+
+    std::cout << '\n';
+
+    std::cout << "fields\tns/field\tns/field (reserved)\n";
+
+    for (std::size_t fields {25}; fields <= 12800; fields *= 2) {
+        const double cost {build_messages(fields, false)};
+        const double cost_reserved {build_messages(fields, true)};
+
+        std::cout << fields << '\t' << cost << '\t' << cost_reserved << '\n';
+    }
+}
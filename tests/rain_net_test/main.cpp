@@ -26,12 +26,30 @@ int main() {
 
     std::cout << message.id() << ", " << message.size() << '\n';
 
+    rain_net::Message message2 {Foo::One};
+
+    const float values[] {1.0f, 2.0f, 3.0f};
+
+    message2 << 4;
+    message2.write_string("Hello");
+    message2.write_array(values, 3);
+
+    int d;
+
+    rain_net::ForwardMessageReader forward_reader;
+    forward_reader(message2) >> d;
+    const auto string {forward_reader.read_string()};
+    const auto array {forward_reader.read_array<float>()};
+
+    std::cout << d << ' ' << string << ' ' << array[0] << ' ' << array[1] << ' ' << array[2] << ' ' << forward_reader.good() << '\n';
+
     asio::io_context ctx;
-    rain_net::internal::SyncQueue<std::pair<rain_net::Message, std::shared_ptr<rain_net::ClientConnection>>> q1;
-    rain_net::internal::SyncQueue<rain_net::Message> q2;
+    rain_net::internal::SpscQueue<std::pair<rain_net::Message, rain_net::ConnectionHandle>> q1;
+    rain_net::internal::SpscQueue<rain_net::Message> q2;
+    rain_net::internal::Notifier notifier;
 
     rain_net::ClientConnection* connection {
-        new rain_net::ClientConnection(ctx, asio::ip::tcp::socket(ctx), q1, 0, {})
+        new rain_net::ClientConnection(ctx, asio::ip::tcp::socket(ctx), q1, notifier, 0, 1, {}, {}, {})
     };
 
     delete connection;
@@ -40,7 +58,7 @@ int main() {
     auto endpoints {resolver.resolve("localhost", "12345")};
 
     rain_net::ServerConnection* connection2 {
-        new rain_net::ServerConnection(ctx, asio::ip::tcp::socket(ctx), q2, endpoints)
+        new rain_net::ServerConnection(ctx, asio::ip::tcp::socket(ctx), q2, notifier, endpoints, {}, {})
     };
 
     delete connection2;